@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* small helpers shared by the programs in this directory. each benchmark
+is a standalone executable that prints one line per measurement; none of
+them take more than a few optional positional arguments. */
+
+namespace f8n { namespace benchmarks {
+
+    using Clock = std::chrono::steady_clock;
+
+    /* wall time, in seconds, it takes to run `fn` once */
+    template <typename Fn>
+    double Time(Fn&& fn) {
+        const auto start = Clock::now();
+        fn();
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /* positional argument `index` (1-based) as an integer, or `fallback` */
+    inline int64_t Argument(int argc, char** argv, int index, int64_t fallback) {
+        return (argc > index) ? std::strtoll(argv[index], nullptr, 10) : fallback;
+    }
+
+    inline void Header(const std::string& title) {
+        printf("\n%s\n%s\n", title.c_str(), std::string(title.size(), '-').c_str());
+    }
+
+    inline void Report(const std::string& name, double value, const std::string& unit) {
+        printf("  %-48s %14.2f %s\n", name.c_str(), value, unit.c_str());
+    }
+
+    /* value at percentile `p` (0..100) of `samples`; sorts in place */
+    inline double Percentile(std::vector<double>& samples, double p) {
+        if (samples.empty()) {
+            return 0.0;
+        }
+        std::sort(samples.begin(), samples.end());
+        const size_t index = std::min(
+            samples.size() - 1, (size_t) ((p / 100.0) * (double) samples.size()));
+        return samples[index];
+    }
+
+    /* keeps the optimizer from discarding a computed value */
+    template <typename T>
+    inline void DoNotOptimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+} }
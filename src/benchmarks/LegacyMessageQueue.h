@@ -0,0 +1,185 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/IMessage.h>
+#include <f8n/runtime/IMessageTarget.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
+
+namespace f8n { namespace benchmarks {
+
+    /* the MessageQueue this library shipped with before the runtime was
+    reworked, trimmed to direct messages: one mutex around everything, a
+    time-ordered std::list searched from the front on every post, a heap
+    allocated node per message, and millisecond system_clock deadlines.
+    kept here so the benchmarks have something fixed to compare against. */
+    class LegacyMessageQueue {
+        public:
+            LegacyMessageQueue() {
+                this->nextMessageTime.store(1);
+            }
+
+            ~LegacyMessageQueue() {
+                for (auto m : this->queue) {
+                    delete m;
+                }
+            }
+
+            void Register(runtime::IMessageTarget* target) {
+                Lock lock(this->queueMutex);
+                this->targets.insert(target);
+            }
+
+            void Unregister(runtime::IMessageTarget* target) {
+                Lock lock(this->queueMutex);
+                this->targets.erase(target);
+            }
+
+            void Post(runtime::IMessagePtr message, int64_t delayMs = 0) {
+                Lock lock(this->queueMutex);
+
+                if (this->targets.find(message->Target()) == this->targets.end()) {
+                    return;
+                }
+
+                Enqueued* m = new Enqueued();
+                m->message = message;
+                m->time = Now() + milliseconds(std::max((int64_t) 0, delayMs));
+
+                auto curr = this->queue.begin();
+                while (curr != this->queue.end() && (*curr)->time <= m->time) {
+                    ++curr;
+                }
+
+                bool first = (curr == this->queue.begin());
+                this->queue.insert(curr, m);
+                this->nextMessageTime.store(this->queue.front()->time.count());
+
+                if (first) {
+                    this->waitForDispatch.notify_all();
+                }
+            }
+
+            void WaitAndDispatch(int64_t timeoutMillis = -1) {
+                {
+                    Lock lock(this->queueMutex);
+
+                    if (this->queue.size()) {
+                        auto waitTime = this->queue.front()->time - Now();
+                        if (timeoutMillis >= 0) {
+                            waitTime = std::min(waitTime, milliseconds(timeoutMillis));
+                        }
+                        if (waitTime.count() > 0) {
+                            this->waitForDispatch.wait_for(lock, waitTime);
+                        }
+                    }
+                    else if (timeoutMillis >= 0) {
+                        this->waitForDispatch.wait_for(lock, milliseconds(timeoutMillis));
+                    }
+                    else {
+                        this->waitForDispatch.wait(lock);
+                    }
+                }
+
+                this->Dispatch();
+            }
+
+            void Dispatch() {
+                const milliseconds now = Now();
+
+                const int64_t nextTime = this->nextMessageTime.load();
+                if (nextTime > now.count() || nextTime < 0) {
+                    return;
+                }
+
+                {
+                    Lock lock(this->queueMutex);
+
+                    this->nextMessageTime.store(-1);
+
+                    auto it = this->queue.begin();
+                    while (it != this->queue.end() && now >= (*it)->time) {
+                        if (this->targets.find((*it)->message->Target()) != this->targets.end()) {
+                            this->dispatch.push_back(*it);
+                        }
+                        else {
+                            delete *it;
+                        }
+                        it = this->queue.erase(it);
+                    }
+
+                    if (this->queue.size()) {
+                        this->nextMessageTime.store(this->queue.front()->time.count());
+                    }
+                }
+
+                for (auto m : this->dispatch) {
+                    m->message->Target()->ProcessMessage(*m->message);
+                    delete m;
+                }
+
+                this->dispatch.clear();
+            }
+
+        private:
+            using milliseconds = std::chrono::milliseconds;
+            using Lock = std::unique_lock<std::mutex>;
+
+            struct Enqueued {
+                runtime::IMessagePtr message;
+                milliseconds time;
+            };
+
+            static milliseconds Now() {
+                return std::chrono::duration_cast<milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch());
+            }
+
+            std::mutex queueMutex;
+            std::condition_variable waitForDispatch;
+            std::list<Enqueued*> queue;
+            std::list<Enqueued*> dispatch;
+            std::set<runtime::IMessageTarget*> targets;
+            std::atomic<int64_t> nextMessageTime;
+    };
+
+} }
@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* counts trips to the general heap while messages are posted and
+dispatched in steady state: every global operator new is counted, and
+the EnqueuedMessage pool reports how often it had to fall back to the
+heap. compares the current MessageQueue with the original design, which
+allocated a queue node plus list links for every message.
+
+    allocations [rounds=1000] [messagesPerRound=1000] */
+
+#include "Benchmark.h"
+#include "LegacyMessageQueue.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/Pool.h>
+#include <f8n/runtime/TimerQueue.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = static_cast<size_t>(alignment);
+    if (void* memory = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+using EnqueuedMessagePool = BlockPool<sizeof(EnqueuedMessage), alignof(EnqueuedMessage)>;
+
+class Counter : public IMessageTarget {
+    public:
+        virtual void ProcessMessage(IMessage& message) override {
+            ++this->count;
+        }
+
+        int64_t count { 0 };
+};
+
+template <typename Queue>
+static void Round(Queue& queue, Counter& counter, int64_t messages) {
+    for (int64_t i = 0; i < messages; i++) {
+        queue.Post(Message::Create(&counter, 1, i));
+    }
+    queue.Dispatch();
+}
+
+template <typename Queue>
+static void Run(const std::string& name, Queue& queue, int64_t rounds, int64_t perRound) {
+    Counter counter;
+    queue.Register(&counter);
+
+    /* the first round fills the pools and sizes the containers */
+    Round(queue, counter, perRound);
+
+    const size_t heapBefore = allocations.load();
+    const size_t poolBefore = EnqueuedMessagePool::HeapAllocations();
+
+    const double seconds = Time([&]() {
+        for (int64_t i = 0; i < rounds; i++) {
+            Round(queue, counter, perRound);
+        }
+    });
+
+    const double messages = (double) (rounds * perRound);
+    const size_t heap = allocations.load() - heapBefore;
+    const size_t pool = EnqueuedMessagePool::HeapAllocations() - poolBefore;
+
+    Report(name + ": heap allocations", (double) heap / messages, "per msg");
+    if (std::is_same<Queue, MessageQueue>::value) {
+        Report(name + ": EnqueuedMessage pool misses", (double) pool, "total");
+    }
+    Report(name + ": post + dispatch", (seconds * 1e9) / messages, "ns/msg");
+
+    queue.Unregister(&counter);
+}
+
+int main(int argc, char** argv) {
+    const int64_t rounds = Argument(argc, argv, 1, 1000);
+    const int64_t perRound = Argument(argc, argv, 2, 1000);
+
+    Header(std::to_string(rounds) + " rounds of " + std::to_string(perRound) + " messages");
+
+    {
+        MessageQueue queue;
+        Run("MessageQueue", queue, rounds, perRound);
+    }
+
+    {
+        LegacyMessageQueue queue;
+        Run("original MessageQueue", queue, rounds, perRound);
+    }
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* the cost of one broadcast fanned out to many receivers: Broadcast()
+followed by Dispatch() on a MessageQueue, versus the original fan-out,
+which copied the std::set of weak_ptr receivers under the queue lock for
+every broadcast before delivering to them.
+
+    broadcast [receivers=200] [broadcasts=20000] */
+
+#include "Benchmark.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+
+#include <iterator>
+#include <mutex>
+#include <set>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+class Receiver : public IMessageTarget {
+    public:
+        virtual void ProcessMessage(IMessage& message) override {
+            ++this->count;
+        }
+
+        int64_t count { 0 };
+};
+
+/* the original MessageQueue::Dispatch(IMessagePtr) broadcast path */
+class LegacyFanOut {
+    public:
+        void Add(IMessageTargetPtr target) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->receivers.insert(target);
+        }
+
+        void Dispatch(IMessagePtr message) {
+            std::set<Weak, std::owner_less<Weak>> copy;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                std::copy(
+                    this->receivers.begin(),
+                    this->receivers.end(),
+                    std::inserter(copy, copy.begin()));
+            }
+            for (auto receiver : copy) {
+                auto shared = receiver.lock();
+                if (shared) {
+                    shared->ProcessMessage(*message);
+                }
+            }
+        }
+
+    private:
+        using Weak = std::weak_ptr<IMessageTarget>;
+
+        std::mutex mutex;
+        std::set<Weak, std::owner_less<Weak>> receivers;
+};
+
+int main(int argc, char** argv) {
+    const int64_t count = Argument(argc, argv, 1, 200);
+    const int64_t broadcasts = Argument(argc, argv, 2, 20000);
+
+    std::vector<std::shared_ptr<Receiver>> receivers;
+    for (int64_t i = 0; i < count; i++) {
+        receivers.push_back(std::make_shared<Receiver>());
+    }
+
+    Header(std::to_string(broadcasts) + " broadcasts to " +
+        std::to_string(count) + " receivers");
+
+    {
+        MessageQueue queue;
+        for (auto& receiver : receivers) {
+            queue.RegisterForBroadcasts(receiver);
+        }
+
+        const double seconds = Time([&]() {
+            for (int64_t i = 0; i < broadcasts; i++) {
+                queue.Broadcast(Message::Create(nullptr, 1));
+                queue.Dispatch();
+            }
+        });
+
+        Report("MessageQueue: per broadcast", (seconds * 1e9) / (double) broadcasts, "ns");
+        Report("MessageQueue: per delivery", (seconds * 1e9) / (double) (broadcasts * count), "ns");
+    }
+
+    {
+        LegacyFanOut fanOut;
+        for (auto& receiver : receivers) {
+            fanOut.Add(receiver);
+        }
+
+        const double seconds = Time([&]() {
+            for (int64_t i = 0; i < broadcasts; i++) {
+                fanOut.Dispatch(Message::Create(nullptr, 1));
+            }
+        });
+
+        Report("original fan-out: per broadcast", (seconds * 1e9) / (double) broadcasts, "ns");
+        Report("original fan-out: per delivery", (seconds * 1e9) / (double) (broadcasts * count), "ns");
+    }
+
+    for (auto& receiver : receivers) {
+        if (receiver->count != broadcasts * 2) {
+            fprintf(stderr, "receiver missed a broadcast\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* the daemon's signal handling when the process already has threads of
+its own by the time start() is called. such a thread doesn't have the
+loop's signals blocked, so it's where the kernel delivers them; they
+should still reach OnSignal() and SIGTERM should still drain the loop and
+run OnDeinit(), instead of the default action killing the process. also
+checks that threads started from OnWorkerInit() inherit the mask, and
+that a signal raised before the loop is up isn't lost. exits non-zero if
+any check fails (or after 10 seconds). run by ctest.
+
+    daemon_signals */
+
+#include <f8n/daemon/daemon.h>
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+#include <unistd.h>
+
+static std::atomic<int> failures(0);
+
+#define CHECK(x) \
+    if (!(x)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+        ++failures; \
+    }
+
+static bool isBlocked(int signal) {
+    sigset_t mask;
+    pthread_sigmask(SIG_BLOCK, nullptr, &mask);
+    return sigismember(&mask, signal) == 1;
+}
+
+class SignalsDaemon : public f8n::daemon::Daemon {
+    public:
+        std::atomic<bool> initialized { false };
+        std::atomic<int> usr1 { 0 };
+        std::atomic<int> hup { 0 };
+        std::atomic<bool> deinitialized { false };
+
+        virtual std::string Name() override { return "daemon_signals"; }
+        virtual std::string Version() override { return "0"; }
+        virtual std::string Hash() override { return ""; }
+
+        virtual std::string LockFilename() override {
+            return "/tmp/f8n_daemon_signals." + std::to_string((int) getpid()) + ".lock";
+        }
+
+        virtual std::vector<int> GetSignals() override {
+            return { SIGUSR1, SIGHUP };
+        }
+
+        virtual void OnWorkerInit(int worker, const std::vector<int>& fds) override {
+            std::thread([]() {
+                CHECK(isBlocked(SIGTERM));
+                CHECK(isBlocked(SIGUSR1));
+                CHECK(isBlocked(SIGHUP));
+            }).join();
+
+            /* the loop isn't reading signals yet; this one must wait for it */
+            pthread_kill(pthread_self(), SIGHUP);
+        }
+
+        virtual void OnSignal(int signal, int count) override {
+            if (signal == SIGUSR1) {
+                this->usr1 += count;
+            }
+            else if (signal == SIGHUP) {
+                this->hup += count;
+            }
+        }
+
+        virtual void OnInit(f8n::daemon::Type type, f8n::runtime::MessageQueue& messageQueue) override {
+            this->initialized = true;
+        }
+
+        virtual void OnDeinit() override {
+            this->deinitialized = true;
+        }
+};
+
+static void waitFor(const std::atomic<bool>& condition) {
+    while (!condition.load()) {
+        usleep(1000);
+    }
+}
+
+int main(int argc, char** argv) {
+    alarm(10); /* never hang ctest */
+
+    SignalsDaemon daemon;
+    std::atomic<bool> signaled(false);
+
+    /* started before the daemon, so it has nothing blocked */
+    std::thread caller([&daemon, &signaled]() {
+        CHECK(!isBlocked(SIGUSR1));
+        waitFor(daemon.initialized);
+        kill(getpid(), SIGUSR1);
+        while (daemon.usr1.load() == 0) {
+            usleep(1000);
+        }
+        kill(getpid(), SIGTERM);
+        signaled = true;
+    });
+
+    char name[] = "daemon_signals";
+    char foreground[] = "--foreground";
+    char* args[] = { name, foreground, nullptr };
+    f8n::daemon::start(2, args, daemon);
+
+    waitFor(signaled);
+    caller.join();
+    unlink(daemon.LockFilename().c_str());
+
+    CHECK(daemon.usr1.load() == 1);
+    CHECK(daemon.hup.load() == 1);
+    CHECK(daemon.deinitialized.load());
+
+    printf("%s\n", failures.load() ? "FAILED" : "passed");
+    return failures.load() ? 1 : 0;
+}
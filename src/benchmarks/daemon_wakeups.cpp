@@ -0,0 +1,221 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* cross-thread posts into the daemon's libev loop. producer threads post
+as fast as they can while the loop dispatches; reports throughput and
+how many read()/write() syscalls (from /proc/self/io) each message cost.
+the current EvMessageQueue wakes the loop through a single coalescing
+ev::async; the original wrote a two-byte event into a pipe on every
+post, and the loop read them back one at a time.
+
+built only when libev is found; the daemon uses epoll on linux unless
+F8N_DAEMON_USE_LIBEV is defined, which this target does.
+
+    daemon_wakeups [producers=4] [messagesPerProducer=100000] */
+
+#include "Benchmark.h"
+
+#include <f8n/daemon/daemon.h>
+
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+/* the original daemon's queue: one pipe write per post */
+class PipeMessageQueue : public MessageQueue {
+    public:
+        PipeMessageQueue() {
+            if (pipe(this->fds) != 0) {
+                this->fds[0] = this->fds[1] = -1;
+            }
+        }
+
+        virtual ~PipeMessageQueue() {
+            close(this->fds[0]);
+            close(this->fds[1]);
+        }
+
+        virtual void Post(IMessagePtr message, int64_t delayMs = 0) override {
+            MessageQueue::Post(message, delayMs);
+            this->Write(EventDispatch);
+        }
+
+        void Run() {
+            io.set(loop);
+            io.set(this->fds[0], ev::READ);
+            io.set<PipeMessageQueue, &PipeMessageQueue::OnReadable>(this);
+            io.start();
+            loop.run(0);
+        }
+
+        void Quit() {
+            this->Write(EventQuit);
+        }
+
+    private:
+        static const short EventDispatch = 1;
+        static const short EventQuit = 2;
+
+        void Write(short event) {
+            if (write(this->fds[1], &event, sizeof(event)) != sizeof(event)) {
+                fprintf(stderr, "write() failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        void OnReadable(ev::io& watcher, int revents) {
+            short event;
+            if (read(this->fds[0], &event, sizeof(event)) != sizeof(event)) {
+                fprintf(stderr, "read() failed\n");
+                exit(EXIT_FAILURE);
+            }
+            switch (event) {
+                case EventDispatch: this->Dispatch(); break;
+                case EventQuit: loop.break_loop(ev::ALL); break;
+            }
+        }
+
+        int fds[2];
+        ev::dynamic_loop loop;
+        ev::io io;
+};
+
+/* read and write syscalls made by this process so far */
+static int64_t Syscalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    int64_t value, total = 0;
+    while (io >> key >> value) {
+        if (key == "syscr:" || key == "syscw:") {
+            total += value;
+        }
+    }
+    return total;
+}
+
+class Counter : public IMessageTarget {
+    public:
+        Counter(int64_t total, std::function<void()> done)
+        : total(total), done(done) {
+        }
+
+        virtual void ProcessMessage(IMessage& message) override {
+            if (message.Type() == MessageStart) {
+                this->started.store(true);
+            }
+            else if (++this->count == this->total) {
+                this->done();
+            }
+        }
+
+        static const int MessageStart = 0;
+        static const int MessageWork = 1;
+
+        std::atomic<bool> started { false };
+
+    private:
+        int64_t count { 0 };
+        int64_t total;
+        std::function<void()> done;
+};
+
+template <typename Queue>
+static void Run(
+    const std::string& name,
+    Queue& queue,
+    std::function<void()> quit,
+    int producers,
+    int64_t perProducer)
+{
+    const int64_t total = producers * perProducer;
+    Counter counter(total, quit);
+    queue.Register(&counter);
+
+    const int64_t syscallsBefore = Syscalls();
+
+    /* the loop handles this first thing, so producers only start once
+    it's running and waiting for wakeups */
+    queue.Post(Message::Create(&counter, Counter::MessageStart));
+
+    const double seconds = Time([&]() {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producers; i++) {
+            threads.emplace_back([&]() {
+                while (!counter.started.load()) {
+                    std::this_thread::yield();
+                }
+                for (int64_t j = 0; j < perProducer; j++) {
+                    queue.Post(Message::Create(&counter, Counter::MessageWork));
+                }
+            });
+        }
+
+        queue.Run();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    });
+
+    const int64_t syscalls = Syscalls() - syscallsBefore;
+
+    queue.Unregister(&counter);
+
+    Report(name + ": throughput", (double) total / seconds, "msgs/sec");
+    Report(name + ": read/write syscalls", (double) syscalls * 1000.0 / (double) total, "per 1000 msgs");
+}
+
+int main(int argc, char** argv) {
+    const int producers = (int) Argument(argc, argv, 1, 4);
+    const int64_t perProducer = Argument(argc, argv, 2, 100000);
+
+    Header(std::to_string(producers) + " producers posting " +
+        std::to_string(producers * perProducer) + " messages to the loop");
+
+    {
+        /* the loop quits on SIGTERM, like the daemon does */
+        f8n::daemon::internal::EvMessageQueue queue;
+        Run("EvMessageQueue (ev::async)", queue, []() { raise(SIGTERM); }, producers, perProducer);
+    }
+
+    {
+        PipeMessageQueue queue;
+        Run("original (pipe per post)", queue, [&queue]() { queue.Quit(); }, producers, perProducer);
+    }
+
+    return 0;
+}
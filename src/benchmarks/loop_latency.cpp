@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* latency through the two loops the daemon can run on: the native epoll
+one (eventfd wakeups, timerfd deadlines) and the libev one. measures how
+long a message posted from another thread takes to reach its handler,
+and how late delayed messages fire past their deadlines.
+
+built only when libev is found; see daemon_wakeups.
+
+    loop_latency [samples=2000] */
+
+#include "Benchmark.h"
+
+#include <f8n/daemon/daemon.h>
+#include <f8n/runtime/EpollMessageQueue.h>
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+using namespace std::chrono;
+
+static int64_t Nanoseconds() {
+    return duration_cast<nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/* UserData1 carries when the message was due, in steady_clock ns */
+class Recorder : public IMessageTarget {
+    public:
+        Recorder(int64_t expected, std::function<void()> done)
+        : expected(expected), done(done) {
+        }
+
+        virtual void ProcessMessage(IMessage& message) override {
+            this->samples.push_back((double) (Nanoseconds() - message.UserData1()) / 1000.0);
+            if ((int64_t) this->samples.size() == this->expected) {
+                this->done();
+            }
+        }
+
+        std::vector<double> samples; /* microseconds; only touched on the loop */
+
+    private:
+        int64_t expected;
+        std::function<void()> done;
+};
+
+template <typename Queue>
+static void Run(
+    const std::string& name,
+    Queue& queue,
+    std::function<void()> quit,
+    int64_t samples,
+    bool delayed)
+{
+    Recorder recorder(samples, quit);
+    queue.Register(&recorder);
+
+    std::thread producer([&]() {
+        std::mt19937 random(1234);
+        std::uniform_int_distribution<int64_t> delay(1, 5);
+        std::uniform_int_distribution<int64_t> gap(100, 500);
+
+        /* let the loop get to its first wait */
+        std::this_thread::sleep_for(milliseconds(10));
+
+        for (int64_t i = 0; i < samples; i++) {
+            const int64_t delayMs = delayed ? delay(random) : 0;
+            const int64_t due = Nanoseconds() + delayMs * 1000000;
+            queue.Post(Message::Create(&recorder, 1, due), delayMs);
+            std::this_thread::sleep_for(microseconds(gap(random)));
+        }
+    });
+
+    queue.Run();
+    producer.join();
+    queue.Unregister(&recorder);
+
+    auto& results = recorder.samples;
+    const std::string kind = delayed ? "timer lateness" : "wakeup";
+    Report(name + " " + kind + ": p50", Percentile(results, 50), "us");
+    Report(name + " " + kind + ": p99", Percentile(results, 99), "us");
+    Report(name + " " + kind + ": max", Percentile(results, 100), "us");
+}
+
+int main(int argc, char** argv) {
+    const int64_t samples = Argument(argc, argv, 1, 2000);
+
+    Header(std::to_string(samples) + " cross-thread posts, immediate and 1-5 ms delayed");
+
+    for (bool delayed : { false, true }) {
+        {
+            EpollMessageQueue queue;
+            Run("epoll", queue, [&queue]() { queue.Quit(); }, samples, delayed);
+        }
+
+        {
+            /* the libev loop quits on SIGTERM, like the daemon does */
+            f8n::daemon::internal::EvMessageQueue queue;
+            Run("libev", queue, []() { raise(SIGTERM); }, samples, delayed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* many producer threads post to a single consumer as fast as they can;
+reports end-to-end throughput (every message posted and processed) for
+the current MessageQueue and for the original single-mutex design.
+
+    post_throughput [producers=8] [messagesPerProducer=125000] */
+
+#include "Benchmark.h"
+#include "LegacyMessageQueue.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+class Counter : public IMessageTarget {
+    public:
+        virtual void ProcessMessage(IMessage& message) override {
+            this->count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::atomic<int64_t> count { 0 };
+};
+
+template <typename Queue>
+static double Run(Queue& queue, int producers, int64_t perProducer) {
+    Counter counter;
+    queue.Register(&counter);
+
+    const int64_t total = producers * perProducer;
+
+    const double seconds = Time([&]() {
+        std::thread consumer([&]() {
+            while (counter.count.load(std::memory_order_relaxed) < total) {
+                queue.WaitAndDispatch(1);
+            }
+        });
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producers; i++) {
+            threads.emplace_back([&]() {
+                for (int64_t j = 0; j < perProducer; j++) {
+                    queue.Post(Message::Create(&counter, 1));
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        consumer.join();
+    });
+
+    queue.Unregister(&counter);
+
+    return (double) total / seconds;
+}
+
+int main(int argc, char** argv) {
+    const int producers = (int) Argument(argc, argv, 1, 8);
+    const int64_t perProducer = Argument(argc, argv, 2, 125000);
+
+    Header(std::to_string(producers) + " producers, 1 consumer, " +
+        std::to_string(producers * perProducer) + " messages");
+
+    {
+        MessageQueue queue;
+        Report("MessageQueue", Run(queue, producers, perProducer), "msgs/sec");
+    }
+
+    {
+        LegacyMessageQueue queue;
+        Report("original MessageQueue", Run(queue, producers, perProducer), "msgs/sec");
+    }
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* concurrent read throughput: 1..N threads run point queries for a fixed
+time against a ConnectionPool with N readers -- leasing a reader either
+per query or once per thread -- versus the same threads sharing a single
+Connection. the database is a
+temporary file, since readers need WAL and their own connections.
+
+    read_pool_qps [maxThreads=hardware_concurrency] [millisPerRun=1000]
+        [rows=100000] */
+
+#include "Benchmark.h"
+
+#include <f8n/db/Connection.h>
+#include <f8n/db/ConnectionPool.h>
+#include <f8n/db/ScopedTransaction.h>
+#include <f8n/db/Statement.h>
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::db;
+
+static const char* QUERY = "SELECT value FROM items WHERE id = ?";
+
+static int64_t PointQuery(Connection& connection, int64_t id) {
+    Statement query(QUERY, connection);
+    query.BindInt64(0, id);
+    return (query.Step() == Row) ? query.ColumnInt64(0) : 0;
+}
+
+/* runs `threads` threads for `millis`, each calling `query` with its
+index and random ids; returns queries per second */
+static double Run(int threads, int64_t millis, int64_t rows, std::function<int64_t(int, int64_t)> query) {
+    std::atomic<bool> done(false);
+    std::atomic<int64_t> total(0);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            std::mt19937 random((unsigned) i);
+            std::uniform_int_distribution<int64_t> id(0, rows - 1);
+            int64_t count = 0, sum = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                sum += query(i, id(random));
+                ++count;
+            }
+            DoNotOptimize(sum);
+            total.fetch_add(count);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    done.store(true);
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    return (double) total.load() * 1000.0 / (double) millis;
+}
+
+int main(int argc, char** argv) {
+    const int64_t maxThreads = Argument(argc, argv, 1,
+        std::max(1u, std::thread::hardware_concurrency()));
+    const int64_t millis = Argument(argc, argv, 2, 1000);
+    const int64_t rows = Argument(argc, argv, 3, 100000);
+
+    const std::string path = "read_pool_qps.db";
+    for (auto suffix : { "", "-wal", "-shm" }) {
+        std::remove((path + suffix).c_str());
+    }
+
+    {
+        Connection connection;
+        connection.Open(path);
+        connection.Execute("PRAGMA journal_mode=WAL");
+        connection.Execute("CREATE TABLE items (id INTEGER PRIMARY KEY, value INTEGER)");
+        ScopedTransaction transaction(connection);
+        for (int64_t i = 0; i < rows; i++) {
+            Statement insert("INSERT INTO items (id, value) VALUES (?, ?)", connection);
+            insert.BindInt64(0, i);
+            insert.BindInt64(1, i * 2);
+            insert.Step();
+        }
+    }
+
+    Header("point queries over " + std::to_string(rows) + " rows, " +
+        std::to_string(millis) + " ms per run");
+
+    for (int64_t threads = 1; threads <= maxThreads; threads++) {
+        const std::string suffix = ", " + std::to_string(threads) + " threads";
+
+        {
+            ConnectionPool pool;
+            pool.Open(path, (size_t) threads);
+            const double qps = Run((int) threads, millis, rows, [&pool](int, int64_t id) {
+                auto reader = pool.Read();
+                return PointQuery(*reader, id);
+            });
+            Report("pool, lease per query" + suffix, qps, "queries/sec");
+        }
+
+        {
+            ConnectionPool pool;
+            pool.Open(path, (size_t) threads);
+            std::vector<ConnectionPool::Lease> leases;
+            for (int64_t i = 0; i < threads; i++) {
+                leases.push_back(pool.Read());
+            }
+            const double qps = Run((int) threads, millis, rows, [&leases](int thread, int64_t id) {
+                return PointQuery(*leases[thread], id);
+            });
+            Report("pool, lease per thread" + suffix, qps, "queries/sec");
+        }
+
+        {
+            Connection shared;
+            shared.Open(path);
+            const double qps = Run((int) threads, millis, rows, [&shared](int, int64_t id) {
+                return PointQuery(shared, id);
+            });
+            Report("one shared connection" + suffix, qps, "queries/sec");
+        }
+    }
+
+    for (auto suffix : { "", "-wal", "-shm" }) {
+        std::remove((path + suffix).c_str());
+    }
+
+    return 0;
+}
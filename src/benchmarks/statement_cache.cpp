@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* point queries by primary key, the workload the statement cache exists
+for: every query constructs a Statement from the same sql text, binds an
+id, and steps once. compares the default cache against a connection with
+the cache disabled, which prepares (and finalizes) on every query.
+
+    statement_cache [rows=100000] [queries=500000] */
+
+#include "Benchmark.h"
+
+#include <f8n/db/Connection.h>
+#include <f8n/db/ScopedTransaction.h>
+#include <f8n/db/Statement.h>
+
+#include <random>
+
+using namespace f8n::benchmarks;
+using namespace f8n::db;
+
+static const char* QUERY = "SELECT value FROM items WHERE id = ?\n";
+
+static void Populate(Connection& connection, int64_t rows) {
+    connection.Execute("CREATE TABLE items (id INTEGER PRIMARY KEY, value INTEGER)");
+    ScopedTransaction transaction(connection);
+    for (int64_t i = 0; i < rows; i++) {
+        Statement insert("INSERT INTO items (id, value) VALUES (?, ?)", connection);
+        insert.BindInt64(0, i);
+        insert.BindInt64(1, i * 2);
+        insert.Step();
+    }
+}
+
+static void Run(const std::string& name, size_t cacheSize, int64_t rows, int64_t queries) {
+    Connection connection;
+    connection.Open(":memory:");
+    Populate(connection, rows);
+    connection.SetStatementCacheSize(cacheSize);
+
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int64_t> id(0, rows - 1);
+    int64_t sum = 0;
+
+    const auto before = connection.GetStatementCacheStats();
+
+    const double seconds = Time([&]() {
+        for (int64_t i = 0; i < queries; i++) {
+            Statement query(QUERY, connection);
+            query.BindInt64(0, id(random));
+            if (query.Step() == Row) {
+                sum += query.ColumnInt64(0);
+            }
+        }
+    });
+
+    const auto after = connection.GetStatementCacheStats();
+
+    DoNotOptimize(sum);
+
+    Report(name + ": per query", (seconds * 1e9) / (double) queries, "ns");
+    Report(name + ": cache hit rate",
+        100.0 * (double) (after.hits - before.hits) / (double) queries, "%");
+}
+
+int main(int argc, char** argv) {
+    const int64_t rows = Argument(argc, argv, 1, 100000);
+    const int64_t queries = Argument(argc, argv, 2, 500000);
+
+    Header(std::to_string(queries) + " point queries over " + std::to_string(rows) + " rows");
+
+    Run("statement cache", Connection::DefaultStatementCacheSize, rows, queries);
+    Run("no statement cache", 0, rows, queries);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* how ThreadPoolMessageQueue throughput scales with its thread count.
+messages are spread over many targets, and each handler burns a fixed
+amount of cpu; the single-threaded MessageQueue, which runs handlers
+inline on the dispatching thread, is the baseline.
+
+    thread_pool_scaling [maxThreads=hardware_concurrency] [messages=200000]
+        [targets=64] [workPerMessage=2000] */
+
+#include "Benchmark.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/ThreadPoolMessageQueue.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+class Worker : public IMessageTarget {
+    public:
+        Worker(std::atomic<int64_t>& processed, int64_t work)
+        : processed(processed), work(work) {
+        }
+
+        virtual void ProcessMessage(IMessage& message) override {
+            uint64_t value = (uint64_t) message.UserData1();
+            for (int64_t i = 0; i < this->work; i++) {
+                value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+            }
+            DoNotOptimize(value);
+            this->processed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t>& processed;
+        int64_t work;
+};
+
+static double Run(MessageQueue& queue, int64_t messages, int64_t targets, int64_t work) {
+    std::atomic<int64_t> processed(0);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int64_t i = 0; i < targets; i++) {
+        workers.emplace_back(new Worker(processed, work));
+        queue.Register(workers.back().get());
+    }
+
+    const double seconds = Time([&]() {
+        for (int64_t i = 0; i < messages; i++) {
+            queue.Post(Message::Create(workers[i % targets].get(), 1, i));
+        }
+        while (processed.load(std::memory_order_relaxed) < messages) {
+            queue.Dispatch();
+            std::this_thread::yield();
+        }
+    });
+
+    for (auto& worker : workers) {
+        queue.Unregister(worker.get());
+    }
+
+    return (double) messages / seconds;
+}
+
+int main(int argc, char** argv) {
+    const int64_t maxThreads = Argument(argc, argv, 1,
+        std::max(1u, std::thread::hardware_concurrency()));
+    const int64_t messages = Argument(argc, argv, 2, 200000);
+    const int64_t targets = Argument(argc, argv, 3, 64);
+    const int64_t work = Argument(argc, argv, 4, 2000);
+
+    Header(std::to_string(messages) + " messages over " + std::to_string(targets) +
+        " targets, " + std::to_string(work) + " iterations of work each");
+
+    double baseline = 0.0;
+    {
+        MessageQueue queue;
+        baseline = Run(queue, messages, targets, work);
+        Report("MessageQueue (inline)", baseline, "msgs/sec");
+    }
+
+    for (int64_t threads = 1; threads <= maxThreads; threads++) {
+        ThreadPoolMessageQueue queue((size_t) threads);
+        const double rate = Run(queue, messages, targets, work);
+        Report("ThreadPoolMessageQueue, " + std::to_string(threads) + " threads", rate, "msgs/sec");
+        Report("  speedup over inline", rate / baseline, "x");
+    }
+
+    return 0;
+}
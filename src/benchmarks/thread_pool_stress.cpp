@@ -0,0 +1,218 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* exercises ThreadPoolMessageQueue's registration edge cases. meant to
+be built with -fsanitize=address or -fsanitize=thread (e.g. configure
+with -DCMAKE_CXX_FLAGS=-fsanitize=address), where a handler running on a
+target that's already been deleted is reported immediately; the checks
+below catch the rest. exits non-zero if any of them fail. also run by
+ctest.
+
+    thread_pool_stress [rounds=20000] */
+
+#include <f8n/runtime/ThreadPoolMessageQueue.h>
+#include <f8n/runtime/Message.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace f8n::runtime;
+using namespace std::chrono;
+
+static std::atomic<int> failures(0);
+
+#define CHECK(x) \
+    if (!(x)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+        ++failures; \
+    }
+
+static const int64_t MAGIC = 0x5ca1ab1e;
+
+class Target : public IMessageTarget {
+    public:
+        Target() : magic(MAGIC), processed(0) { }
+        ~Target() { magic = 0; }
+
+        virtual void ProcessMessage(IMessage &message) override {
+            CHECK(this->magic == MAGIC);
+            ++this->processed;
+        }
+
+        volatile int64_t magic;
+        std::atomic<int> processed;
+};
+
+/* a target is unregistered and deleted while the dispatcher thread is
+handing its messages to the pool. Unregister() promises the target won't
+be called once it returns. */
+static void UnregisterWhileDispatching(int rounds) {
+    ThreadPoolMessageQueue queue(4);
+    std::atomic<bool> done(false);
+
+    std::thread dispatcher([&queue, &done]() {
+        while (!done.load()) {
+            queue.Dispatch();
+        }
+    });
+
+    for (int i = 0; i < rounds; i++) {
+        auto target = new Target();
+        queue.Register(target);
+        for (int j = 0; j < 16; j++) {
+            queue.Post(Message::Create(target, 1));
+        }
+        if (i % 2) {
+            std::this_thread::yield();
+        }
+        queue.Unregister(target);
+        delete target;
+    }
+
+    done.store(true);
+    dispatcher.join();
+}
+
+/* a target is both registered and a broadcast receiver. unregistering it
+for broadcasts must not throw away its direct messages. */
+static void UnregisterForBroadcastsKeepsDirectWork() {
+    class Gated : public Target {
+        public:
+            virtual void ProcessMessage(IMessage &message) override {
+                if (message.Type() == 1) {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->entered = true;
+                    this->changed.notify_all();
+                    while (!this->open) {
+                        this->changed.wait(lock);
+                    }
+                }
+                Target::ProcessMessage(message);
+            }
+
+            void WaitUntilEntered() {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while (!this->entered) {
+                    this->changed.wait(lock);
+                }
+            }
+
+            void Open() {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->open = true;
+                this->changed.notify_all();
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable changed;
+            bool entered { false };
+            bool open { false };
+    };
+
+    const int count = 100;
+
+    ThreadPoolMessageQueue queue(2);
+    auto target = std::make_shared<Gated>();
+    queue.Register(target.get());
+    queue.RegisterForBroadcasts(target);
+
+    /* the first message parks the strand so everything after it is
+    sitting in the pool, not the queue, when we unregister */
+    queue.Post(Message::Create(target.get(), 1));
+    for (int i = 0; i < count; i++) {
+        queue.Post(Message::Create(target.get(), 2));
+    }
+    queue.Dispatch();
+    target->WaitUntilEntered();
+
+    std::thread unregister([&queue, &target]() {
+        queue.UnregisterForBroadcasts(target.get());
+    });
+
+    std::this_thread::sleep_for(milliseconds(10));
+    target->Open();
+    unregister.join();
+
+    auto deadline = steady_clock::now() + seconds(5);
+    while (target->processed.load() < count + 1 && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    CHECK(target->processed.load() == count + 1);
+
+    queue.Unregister(target.get());
+}
+
+/* broadcast receivers come and go while broadcasts are in flight. */
+static void BroadcastChurn(int rounds) {
+    ThreadPoolMessageQueue queue(4);
+    std::atomic<bool> done(false);
+
+    std::thread dispatcher([&queue, &done]() {
+        while (!done.load()) {
+            queue.Broadcast(Message::Create(nullptr, 1));
+            queue.Dispatch();
+        }
+    });
+
+    for (int i = 0; i < rounds; i++) {
+        auto target = std::make_shared<Target>();
+        queue.RegisterForBroadcasts(target);
+        std::this_thread::yield();
+        queue.UnregisterForBroadcasts(target.get());
+        const int processed = target->processed.load();
+        std::this_thread::yield();
+        CHECK(target->processed.load() == processed);
+    }
+
+    done.store(true);
+    dispatcher.join();
+}
+
+int main(int argc, char** argv) {
+    const int rounds = (argc > 1) ? atoi(argv[1]) : 20000;
+
+    UnregisterWhileDispatching(rounds);
+    UnregisterForBroadcastsKeepsDirectWork();
+    BroadcastChurn(rounds / 10);
+
+    printf("%s\n", failures.load() ? "FAILED" : "ok");
+    return failures.load() ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* how late do delayed messages fire? a producer posts timers with random
+delays while a consumer thread sits in WaitAndDispatch(); each handler
+records how far past its deadline it ran. the original queue kept
+millisecond system_clock deadlines, so its timers fired up to a
+millisecond early or late; the current one uses steady_clock time.
+
+    timer_jitter [timers=500] [maxDelayMs=20] */
+
+#include "Benchmark.h"
+#include "LegacyMessageQueue.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+using namespace std::chrono;
+
+class Recorder : public IMessageTarget {
+    public:
+        /* UserData1 carries the deadline, in steady_clock nanoseconds */
+        virtual void ProcessMessage(IMessage& message) override {
+            const int64_t now = duration_cast<nanoseconds>(
+                Clock::now().time_since_epoch()).count();
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->lateness.push_back((double) (now - message.UserData1()) / 1000.0);
+        }
+
+        size_t Count() {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            return this->lateness.size();
+        }
+
+        std::mutex mutex;
+        std::vector<double> lateness; /* microseconds; negative is early */
+};
+
+template <typename Queue>
+static void Run(const std::string& name, Queue& queue, int64_t timers, int64_t maxDelay) {
+    Recorder recorder;
+    queue.Register(&recorder);
+
+    std::atomic<bool> done(false);
+    std::thread consumer([&]() {
+        while (!done.load()) {
+            queue.WaitAndDispatch(10);
+        }
+    });
+
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int64_t> delay(1, std::max((int64_t) 1, maxDelay));
+    std::uniform_int_distribution<int64_t> gap(0, 2000);
+
+    for (int64_t i = 0; i < timers; i++) {
+        const int64_t delayMs = delay(random);
+        const int64_t deadline = duration_cast<nanoseconds>(
+            (Clock::now() + milliseconds(delayMs)).time_since_epoch()).count();
+        queue.Post(Message::Create(&recorder, 1, deadline), delayMs);
+        std::this_thread::sleep_for(microseconds(gap(random)));
+    }
+
+    while (recorder.Count() < (size_t) timers) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    done.store(true);
+    consumer.join();
+    queue.Unregister(&recorder);
+
+    auto& samples = recorder.lateness;
+    Report(name + ": earliest", Percentile(samples, 0), "us");
+    Report(name + ": p50", Percentile(samples, 50), "us");
+    Report(name + ": p99", Percentile(samples, 99), "us");
+    Report(name + ": latest", Percentile(samples, 100), "us");
+}
+
+int main(int argc, char** argv) {
+    const int64_t timers = Argument(argc, argv, 1, 500);
+    const int64_t maxDelay = Argument(argc, argv, 2, 20);
+
+    Header(std::to_string(timers) + " timers, delays in [1, " +
+        std::to_string(maxDelay) + "] ms; lateness past deadline");
+
+    {
+        MessageQueue queue;
+        Run("MessageQueue", queue, timers, maxDelay);
+    }
+
+    {
+        LegacyMessageQueue queue;
+        Run("original MessageQueue", queue, timers, maxDelay);
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* posts `messages` messages with uniformly random delays in [0, maxDelay]
+ms to a MessageQueue, once per timer backend, and reports the cost per
+message of posting and dispatching all of them. a VirtualClock advances
+one millisecond per `perTick` posts, so the number of pending timers
+settles around perTick * (maxDelay + 1) / 2; that standing depth is what
+separates the backends.
+
+    timer_queue [messages=1000000] [perTick=1000] [maxDelay...=1 4 16] */
+
+#include "Benchmark.h"
+
+#include <f8n/runtime/Clock.h>
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+
+#include <random>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+class Counter : public IMessageTarget {
+    public:
+        virtual void ProcessMessage(IMessage& message) override {
+            ++this->count;
+        }
+
+        int64_t count { 0 };
+};
+
+static double Run(TimerQueue::Type type, int64_t messages, int64_t perTick, int64_t maxDelay) {
+    auto clock = std::make_shared<VirtualClock>();
+    MessageQueue queue(type, clock);
+    Counter counter;
+    queue.Register(&counter);
+
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int64_t> delay(0, std::max((int64_t) 0, maxDelay));
+
+    const double seconds = Time([&]() {
+        int64_t posted = 0;
+        while (posted < messages) {
+            for (int64_t i = 0; i < perTick && posted < messages; i++, posted++) {
+                queue.Post(Message::Create(&counter, 1), delay(random));
+            }
+            clock->Advance(std::chrono::milliseconds(1));
+            queue.Dispatch();
+        }
+        while (counter.count < messages) {
+            clock->Advance(std::chrono::milliseconds(1));
+            queue.Dispatch();
+        }
+    });
+
+    queue.Unregister(&counter);
+
+    return (seconds * 1e9) / (double) messages;
+}
+
+int main(int argc, char** argv) {
+    const int64_t messages = Argument(argc, argv, 1, 1000000);
+    const int64_t perTick = Argument(argc, argv, 2, 1000);
+
+    std::vector<int64_t> delays;
+    for (int i = 3; i < argc; i++) {
+        delays.push_back(Argument(argc, argv, i, 0));
+    }
+    if (delays.empty()) {
+        delays = { 1, 4, 16 };
+    }
+
+    for (int64_t maxDelay : delays) {
+        Header(std::to_string(messages) + " messages, delays in [0, " +
+            std::to_string(maxDelay) + "] ms, ~" +
+            std::to_string(perTick * (maxDelay + 1) / 2) + " pending");
+
+        Report("heap: post + dispatch", Run(TimerQueue::Type::Heap, messages, perTick, maxDelay), "ns/msg");
+        Report("list: post + dispatch", Run(TimerQueue::Type::List, messages, perTick, maxDelay), "ns/msg");
+    }
+
+    return 0;
+}
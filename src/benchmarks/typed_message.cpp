@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+/* carrying a payload with a message: TypedMessage<T> (pooled, payload
+inline, read back with a static_cast) versus the usual alternative, a
+Message subclass allocated with make_shared and recovered on the other
+side with dynamic_cast. each message is created, posted, dispatched, and
+its payload read. a payload that doesn't fit inline is measured too, as
+is reading the payload on its own. build with NDEBUG, otherwise
+TypedMessage::Payload() verifies its cast with a dynamic_cast as well.
+
+    typed_message [messages=1000000] */
+
+#include "Benchmark.h"
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/TypedMessage.h>
+
+#include <array>
+#include <cstring>
+
+using namespace f8n::benchmarks;
+using namespace f8n::runtime;
+
+struct Small {
+    double x, y, z;
+};
+
+struct Large {
+    std::array<double, 32> values;
+};
+
+template <typename T>
+class SubclassMessage : public Message {
+    public:
+        SubclassMessage(IMessageTarget* target, int type, const T& payload)
+        : Message(target, type, 0LL, 0LL), payload(payload) {
+        }
+
+        T payload;
+};
+
+enum class Style { Typed, Subclass };
+
+template <typename T>
+T MakePayload(int64_t i) {
+    T payload;
+    memset(&payload, 0, sizeof(payload));
+    reinterpret_cast<double*>(&payload)[0] = (double) i;
+    return payload;
+}
+
+template <typename T, Style S>
+class Receiver : public IMessageTarget {
+    public:
+        virtual void ProcessMessage(IMessage& message) override {
+            if (S == Style::Typed) {
+                this->sum += reinterpret_cast<double*>(&TypedMessage<T>::Payload(message))[0];
+            }
+            else if (auto subclass = dynamic_cast<SubclassMessage<T>*>(&message)) {
+                this->sum += reinterpret_cast<double*>(&subclass->payload)[0];
+            }
+        }
+
+        double sum { 0.0 };
+};
+
+template <typename T, Style S>
+static double Run(int64_t messages) {
+    MessageQueue queue;
+    Receiver<T, S> receiver;
+    queue.Register(&receiver);
+
+    const int64_t batch = 1000;
+
+    const double seconds = Time([&]() {
+        for (int64_t i = 0; i < messages; i += batch) {
+            for (int64_t j = i; j < std::min(messages, i + batch); j++) {
+                if (S == Style::Typed) {
+                    queue.Post(TypedMessage<T>::Create(&receiver, 1, MakePayload<T>(j)));
+                }
+                else {
+                    queue.Post(std::make_shared<SubclassMessage<T>>(&receiver, 1, MakePayload<T>(j)));
+                }
+            }
+            queue.Dispatch();
+        }
+    });
+
+    DoNotOptimize(receiver.sum);
+    queue.Unregister(&receiver);
+
+    return (seconds * 1e9) / (double) messages;
+}
+
+/* just the receiving side: recover the payload from the same message
+over and over */
+template <typename T, Style S>
+static double Read(int64_t reads) {
+    Receiver<T, S> receiver;
+    IMessagePtr message = (S == Style::Typed)
+        ? TypedMessage<T>::Create(&receiver, 1, MakePayload<T>(1))
+        : std::make_shared<SubclassMessage<T>>(&receiver, 1, MakePayload<T>(1));
+
+    const double seconds = Time([&]() {
+        for (int64_t i = 0; i < reads; i++) {
+            receiver.ProcessMessage(*message);
+        }
+    });
+
+    DoNotOptimize(receiver.sum);
+
+    return (seconds * 1e9) / (double) reads;
+}
+
+int main(int argc, char** argv) {
+    const int64_t messages = Argument(argc, argv, 1, 1000000);
+
+    Header(std::to_string(messages) + " messages; create, post, dispatch, read payload");
+
+    Report("24 byte payload: TypedMessage", Run<Small, Style::Typed>(messages), "ns/msg");
+    Report("24 byte payload: subclass + dynamic_cast", Run<Small, Style::Subclass>(messages), "ns/msg");
+    Report("256 byte payload: TypedMessage (boxed)", Run<Large, Style::Typed>(messages), "ns/msg");
+    Report("256 byte payload: subclass + dynamic_cast", Run<Large, Style::Subclass>(messages), "ns/msg");
+
+    Header(std::to_string(messages * 10) + " payload reads from one message");
+
+    Report("TypedMessage::Payload()", Read<Small, Style::Typed>(messages * 10), "ns/read");
+    Report("dynamic_cast", Read<Small, Style::Subclass>(messages * 10), "ns/read");
+
+    return 0;
+}
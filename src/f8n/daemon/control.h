@@ -0,0 +1,326 @@
+#pragma once
+
+#include <json.hpp>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace f8n { namespace daemon {
+
+    /* a line-oriented command channel on a unix domain socket, serviced by
+    whatever event loop owns it: the loop calls back through `watch` when
+    the listening socket or a client becomes readable, so nothing here
+    runs on its own thread. each request is a single line of whitespace
+    separated words, e.g. "stats" or "loglevel warning"; each response is
+    a single line of json, either {"ok":true,"result":...} or
+    {"ok":false,"error":"..."}. */
+    class ControlChannel {
+        public:
+            using Arguments = std::vector<std::string>;
+            using Command = std::function<nlohmann::json(const Arguments& args)>;
+            using StatsProvider = std::function<nlohmann::json()>;
+            using WatchFn = std::function<void(int fd, std::function<void()> readable)>;
+            using UnwatchFn = std::function<void(int fd)>;
+
+            ControlChannel(WatchFn watch, UnwatchFn unwatch)
+            : watch(watch), unwatch(unwatch), inode(0), listenFd(-1) {
+                this->RegisterCommand("help", "list the available commands",
+                    [this](const Arguments& args) {
+                        nlohmann::json result;
+                        for (auto& it : this->commands) {
+                            result[it.first] = it.second.help;
+                        }
+                        return result;
+                    });
+
+                this->RegisterCommand("stats", "report every registered stats provider",
+                    [this](const Arguments& args) {
+                        nlohmann::json result = nlohmann::json::object();
+                        for (auto& it : this->stats) {
+                            if (args.empty() || std::find(args.begin(), args.end(), it.first) != args.end()) {
+                                result[it.first] = it.second();
+                            }
+                        }
+                        return result;
+                    });
+            }
+
+            ControlChannel(const ControlChannel&) = delete;
+            ControlChannel& operator=(const ControlChannel&) = delete;
+
+            ~ControlChannel() {
+                this->Close();
+            }
+
+            /* binds the socket (replacing a stale one left by a crash) and
+            starts accepting connections. only the owning user may connect. */
+            bool Listen(const std::string& path) {
+                sockaddr_un address;
+                if (path.size() >= sizeof(address.sun_path)) {
+                    return false;
+                }
+
+                this->Close();
+
+                int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    return false;
+                }
+
+                Configure(fd, true);
+
+                memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+                unlink(path.c_str());
+
+                /* the daemon runs with umask(0); create the socket owner-only
+                front rather than chmod() it after it's already reachable */
+                const mode_t mask = umask(077);
+                const bool bound = bind(fd, (sockaddr*) &address, sizeof(address)) == 0;
+                umask(mask);
+
+                if (!bound || listen(fd, 8) != 0) {
+                    close(fd);
+                    unlink(path.c_str());
+                    return false;
+                }
+
+                struct stat info;
+                this->inode = (stat(path.c_str(), &info) == 0) ? info.st_ino : 0;
+                this->path = path;
+                this->listenFd = fd;
+                this->watch(fd, [this]() { this->Accept(); });
+                return true;
+            }
+
+            void Close() {
+                while (this->connections.size()) {
+                    this->Disconnect(this->connections.begin()->first);
+                }
+                if (this->listenFd >= 0) {
+                    this->unwatch(this->listenFd);
+                    close(this->listenFd);
+                    /* during a --reload the replacement may already have
+                    bound a new socket at the same path; leave that one be */
+                    struct stat info;
+                    if (stat(this->path.c_str(), &info) == 0 && info.st_ino == this->inode) {
+                        unlink(this->path.c_str());
+                    }
+                    this->listenFd = -1;
+                }
+            }
+
+            void RegisterCommand(const std::string& name, const std::string& help, Command command) {
+                this->commands[name] = { help, command };
+            }
+
+            /* stats providers are reported together by the "stats" command
+            (or individually, with "stats <name> ...") */
+            void RegisterStats(const std::string& name, StatsProvider provider) {
+                this->stats[name] = provider;
+            }
+
+            nlohmann::json Execute(const std::string& line) {
+                Arguments args;
+                std::istringstream words(line);
+                std::string word;
+                while (words >> word) {
+                    args.push_back(word);
+                }
+
+                if (args.empty()) {
+                    return Error("empty command");
+                }
+
+                auto it = this->commands.find(args[0]);
+                if (it == this->commands.end()) {
+                    return Error("unknown command: " + args[0]);
+                }
+
+                args.erase(args.begin());
+
+                try {
+                    return { { "ok", true }, { "result", it->second.command(args) } };
+                }
+                catch (std::exception& e) {
+                    return Error(e.what());
+                }
+            }
+
+            /* client side: sends one command and waits (up to timeoutMs)
+            for its response line. */
+            static bool Send(
+                const std::string& path,
+                const std::string& command,
+                std::string& response,
+                int timeoutMs = 5000)
+            {
+                sockaddr_un address;
+                if (path.size() >= sizeof(address.sun_path)) {
+                    return false;
+                }
+
+                int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    return false;
+                }
+
+                Configure(fd, false);
+
+                memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+                const std::string line = command + "\n";
+                bool result = connect(fd, (sockaddr*) &address, sizeof(address)) == 0 &&
+                    WriteAll(fd, line.c_str(), line.size());
+
+                response.clear();
+                char buffer[4096];
+                while (result && response.find('\n') == std::string::npos) {
+                    pollfd pfd = { fd, POLLIN, 0 };
+                    ssize_t count = 0;
+                    if (poll(&pfd, 1, timeoutMs) <= 0 || (count = read(fd, buffer, sizeof(buffer))) <= 0) {
+                        result = false;
+                    }
+                    else {
+                        response.append(buffer, (size_t) count);
+                    }
+                }
+
+                close(fd);
+
+                if (result) {
+                    response.erase(response.find('\n'));
+                }
+                return result;
+            }
+
+        private:
+            static constexpr size_t MaxConnections = 16;
+            static constexpr size_t MaxLineLength = 4096;
+
+            struct Entry {
+                std::string help;
+                Command command;
+            };
+
+            static nlohmann::json Error(const std::string& message) {
+                return { { "ok", false }, { "error", message } };
+            }
+
+            /* done with fcntl rather than SOCK_NONBLOCK/accept4 so this
+            builds on every platform the daemon does */
+            static void Configure(int fd, bool nonblocking) {
+                fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+                if (nonblocking) {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                }
+            }
+
+            static bool WriteAll(int fd, const char* data, size_t size) {
+                size_t offset = 0;
+                while (offset < size) {
+                    ssize_t count = write(fd, data + offset, size - offset);
+                    if (count > 0) {
+                        offset += (size_t) count;
+                    }
+                    else if (count < 0 && errno == EAGAIN) {
+                        /* clients are expected to read promptly; don't let
+                        a stuck one hold the loop for long */
+                        pollfd pfd = { fd, POLLOUT, 0 };
+                        if (poll(&pfd, 1, 100) <= 0) {
+                            return false;
+                        }
+                    }
+                    else if (count < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    else {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            void Accept() {
+                int fd;
+                while ((fd = accept(this->listenFd, nullptr, nullptr)) >= 0) {
+                    Configure(fd, true);
+                    if (this->connections.size() >= MaxConnections) {
+                        close(fd);
+                        continue;
+                    }
+                    this->connections[fd] = std::string();
+                    this->watch(fd, [this, fd]() { this->Read(fd); });
+                }
+            }
+
+            void Read(int fd) {
+                auto it = this->connections.find(fd);
+                if (it == this->connections.end()) {
+                    return;
+                }
+
+                char buffer[1024];
+                ssize_t count = read(fd, buffer, sizeof(buffer));
+                if (count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR)) {
+                    this->Disconnect(fd);
+                    return;
+                }
+                if (count < 0) {
+                    return;
+                }
+
+                std::string& pending = it->second;
+                pending.append(buffer, (size_t) count);
+
+                size_t newline;
+                while ((newline = pending.find('\n')) != std::string::npos) {
+                    const std::string line = pending.substr(0, newline);
+                    pending.erase(0, newline + 1);
+                    const std::string response = this->Execute(line).dump() + "\n";
+                    if (!WriteAll(fd, response.c_str(), response.size())) {
+                        this->Disconnect(fd);
+                        return;
+                    }
+                }
+
+                if (pending.size() > MaxLineLength) {
+                    this->Disconnect(fd);
+                }
+            }
+
+            void Disconnect(int fd) {
+                this->unwatch(fd);
+                close(fd);
+                this->connections.erase(fd);
+            }
+
+            WatchFn watch;
+            UnwatchFn unwatch;
+            std::string path;
+            ino_t inode;
+            int listenFd;
+            std::map<std::string, Entry> commands;
+            std::map<std::string, StatsProvider> stats;
+            std::unordered_map<int, std::string> connections;
+    };
+
+} } /* namespace f8n::daemon */
@@ -1,17 +1,57 @@
 #pragma once
 
-#include <ev++.h>
+/* on Linux the daemon runs its own epoll loop; everywhere else (or if
+F8N_DAEMON_USE_LIBEV is defined) it runs on libev. */
+#if defined(__linux__) && !defined(F8N_DAEMON_USE_LIBEV)
+    #define F8N_DAEMON_USE_EPOLL
+#endif
 
+#ifdef F8N_DAEMON_USE_EPOLL
+    #include <f8n/runtime/EpollMessageQueue.h>
+    #include <sys/epoll.h>
+#else
+    #include <ev++.h>
+#endif
+
+#include <f8n/daemon/control.h>
+#include <f8n/debug/debug.h>
+#include <f8n/runtime/Message.h>
 #include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/Watchdog.h>
 
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <unistd.h>
 
+#ifdef __linux__
+    #include <sys/prctl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#ifdef __APPLE__
+    #include <crt_externs.h> /* environ isn't visible to shared libraries */
+#else
+    extern char** environ;
+#endif
+
 using namespace f8n::runtime;
 
 namespace f8n { namespace daemon {
@@ -26,9 +66,45 @@ namespace f8n { namespace daemon {
         virtual std::string LockFilename() = 0;
         virtual std::vector<int> GetSignals() = 0;
 
-        virtual void OnSignal(int signal) = 0;
+        /* signals from GetSignals() arrive here as messages on the daemon's
+        loop, never in signal context. `count` is the number of times the
+        signal was raised since it was last delivered. SIGTERM and SIGUSR2
+        are reserved. */
+        virtual void OnSignal(int signal, int count) { this->OnSignal(signal); }
+        virtual void OnSignal(int signal) { }
         virtual void OnInit(Type type, f8n::runtime::MessageQueue& messageQueue) = 0;
         virtual void OnDeinit() = 0;
+
+        /* if positive, a watchdog thread logs any message handler that runs
+        for longer than this, and keeps a loop lag histogram. */
+        virtual int64_t WatchdogThresholdMs() { return 0; }
+
+        /* if greater than one, the process becomes a supervisor that forks
+        this many workers, each with its own loop and OnInit() call, and
+        restarts any worker that exits before it's asked to. */
+        virtual int WorkerCount() { return 1; }
+
+        /* called once, before any workers are forked. the returned
+        descriptors (usually listening sockets) are inherited by every
+        worker and handed to OnWorkerInit(). */
+        virtual std::vector<int> OnListen() { return {}; }
+
+        /* called in each worker (or the single process) before OnInit() */
+        virtual void OnWorkerInit(int worker, const std::vector<int>& fds) { }
+
+        /* called in the old process during a --reload, once its replacement
+        is up: stop accepting new work. messages that are already due are
+        dispatched afterwards, then OnDeinit() runs as usual. */
+        virtual void OnDrain() { }
+
+        /* if not empty, each loop serves a ControlChannel on a unix socket
+        at this path (with ".<worker>" appended when there are several
+        workers); query it with --control. */
+        virtual std::string ControlSocketPath() { return ""; }
+
+        /* register additional commands and stats providers; called before
+        OnInit(), after the built-in ones are in place */
+        virtual void OnControl(ControlChannel& channel) { }
     };
 } } /* namespace f8n::daemon */
 
@@ -38,6 +114,13 @@ static void printHelp();
 static void handleCommandLine(int argc, char** argv);
 static void exitIfRunning();
 static pid_t getDaemonPid();
+static std::vector<pid_t> getDaemonPids();
+static void writeLockFile(const std::vector<pid_t>& workers);
+static void supervise(int count);
+static void reloadDaemon();
+static void controlDaemon(int argc, char** argv);
+static void reload();
+static bool handleLoopSignal(int signal);
 static void startForeground();
 static void startDaemon();
 static void start();
@@ -45,84 +128,341 @@ static void stopDaemon();
 static void initUtf8();
 static void run();
 
-static const short EVENT_DISPATCH = 1;
-static const short EVENT_QUIT = 2;
 static const pid_t NOT_RUNNING = (pid_t) -1;
-static int pipeFd[2] = { 0 };
 static Type type = Type::Background;
 
 static Daemon* instance = nullptr;
+static std::unique_ptr<Watchdog> watchdog;
+static std::vector<int> listenFds;
+static int worker = 0;
+static bool supervised = false;
 
-class EvMessageQueue: public MessageQueue {
+/* --reload sends this to the running daemon, which re-execs itself with its
+listening descriptors; the replacement asks the old process to drain and
+exit (with SIGTERM) once OnInit() has returned. the variables are how the
+two processes find each other. */
+static const int RELOAD_SIGNAL = SIGUSR2;
+static const char* RELOAD_PID_ENV = "F8N_RELOAD_PID";
+static const char* LISTEN_FDS_ENV = "F8N_LISTEN_FDS";
+static std::string executable;
+static std::vector<std::string> arguments;
+static pid_t reloadParent = NOT_RUNNING; /* the process we're replacing */
+static pid_t reloadChild = NOT_RUNNING; /* the process replacing us */
+static bool draining = false;
+static int readyFd = -1; /* a worker closes this once OnInit() returns */
+
+/* turns signals read on the loop thread (from a signalfd, or an ev::sig)
+into messages on the daemon's queue, so Daemon::OnSignal() runs as an
+ordinary handler. a signal raised again before its message is dispatched
+only bumps a count, so a storm costs one delivery. */
+class SignalDispatcher: public IMessageTarget {
     public:
-        void Post(IMessagePtr message, int64_t delayMs) {
-            MessageQueue::Post(message, delayMs);
+        static const int SIGNAL_MESSAGE = 1;
 
-            if (delayMs <= 0) {
-                write(pipeFd[1], &EVENT_DISPATCH, sizeof(EVENT_DISPATCH));
-            }
-            else {
-                double delayTs = (double) delayMs / 1000.0;
-                loop.once<
-                    EvMessageQueue,
-                    &EvMessageQueue::DelayedDispatch
-                >(-1, ev::TIMER, (ev::tstamp) delayTs, this);
-            }
+        SignalDispatcher(MessageQueue& queue)
+        : queue(queue) {
+            queue.Register(this);
         }
 
-        void DelayedDispatch(int revents) {
-            this->Dispatch();
+        virtual ~SignalDispatcher() {
+            queue.Unregister(this);
         }
 
-        static void SignalQuit(ev::sig& signal, int revents) {
-            write(pipeFd[1], &EVENT_QUIT, sizeof(EVENT_QUIT));
+        /* loop thread only */
+        void Raise(int signal) {
+            if (this->pending[signal]++ == 0) {
+                this->queue.Post(Message::Create(
+                    this, SIGNAL_MESSAGE, signal, 0LL, MessagePriority::High));
+            }
         }
 
-        void ReadCallback(ev::io& watcher, int revents) {
-            short type;
-            if (read(pipeFd[0], &type, sizeof(type)) == 0) {
-                std::cerr << "read() failed.\n";
-                exit(EXIT_FAILURE);
-            }
-            switch (type) {
-                case EVENT_DISPATCH: this->Dispatch(); break;
-                case EVENT_QUIT: loop.break_loop(ev::ALL); break;
+        virtual void ProcessMessage(IMessage& message) override {
+            const int signal = (int) message.UserData1();
+            auto it = this->pending.find(signal);
+            if (it != this->pending.end()) {
+                const int count = it->second;
+                this->pending.erase(it);
+                instance->OnSignal(signal, count);
             }
         }
 
+    private:
+        MessageQueue& queue;
+        std::unordered_map<int, int> pending;
+};
+
+/* signals the daemon handles itself; see handleLoopSignal() */
+static bool isReservedSignal(int signal) {
+    return signal == SIGTERM || signal == RELOAD_SIGNAL;
+}
+
+/* everything the loop reads: ours, then the ones the Daemon asked for */
+static std::vector<int> loopSignals() {
+    std::vector<int> result = { SIGTERM, RELOAD_SIGNAL };
+    if (!instance) {
+        return result; /* a loop running outside of start() */
+    }
+    for (int signal : instance->GetSignals()) {
+        if (!isReservedSignal(signal)) {
+            result.push_back(signal);
+        }
+    }
+    return result;
+}
+
+static sigset_t loopSignalMask() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signal : loopSignals()) {
+        sigaddset(&mask, signal);
+    }
+    return mask;
+}
+
+static pthread_t signalThread;
+
+static void forwardSignal(int signal) {
+    const int saved = errno;
+    pthread_kill(signalThread, signal);
+    errno = saved;
+}
+
+/* blocks the loop's signals in the calling thread, before it starts any
+other, so they're only ever picked up where the loop reads them. threads
+that were already running (the caller's own) still have them unblocked,
+so the process-wide handler passes anything they catch on to this thread
+rather than leaving it to the default action. */
+static void claimSignals() {
+    const sigset_t mask = loopSignalMask();
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    signalThread = pthread_self();
+
+    struct sigaction action = {};
+    action.sa_handler = forwardSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    for (int signal : loopSignals()) {
+        sigaction(signal, &action, nullptr);
+    }
+}
+
+#ifndef F8N_DAEMON_USE_EPOLL
+
+/* drives the MessageQueue from a libev loop. cross-thread wakeups go
+through a single ev::async, so any number of posts between two loop
+iterations cost at most one wakeup; a single ev::timer is re-armed to the
+queue's next deadline after every dispatch. */
+class EvMessageQueue: public MessageQueue {
+    public:
+        EvMessageQueue()
+        : dispatching(false) {
+            this->running.store(false);
+        }
+
         void Run() {
-            io.set(loop);
-            io.set(pipeFd[0], ev::READ);
-            io.set<EvMessageQueue, &EvMessageQueue::ReadCallback>(this);
-            io.start();
+            this->loopThread = std::this_thread::get_id();
+
+            wakeup.set(loop);
+            wakeup.set<EvMessageQueue, &EvMessageQueue::OnWakeup>(this);
+            wakeup.start();
+
+            timer.set(loop);
+            timer.set<EvMessageQueue, &EvMessageQueue::OnTimer>(this);
 
             sio.set(loop);
-            sio.set<&EvMessageQueue::SignalQuit>();
+            sio.set<EvMessageQueue, &EvMessageQueue::OnQuit>(this);
             sio.start(SIGTERM);
 
-            write(pipeFd[1], &EVENT_DISPATCH, sizeof(EVENT_DISPATCH));
+            reloadSignal.set(loop);
+            reloadSignal.set<EvMessageQueue, &EvMessageQueue::OnReload>(this);
+            reloadSignal.start(RELOAD_SIGNAL);
+
+            /* claimSignals() blocked these so every thread started so far
+            inherits the mask; libev catches them on this one from now on */
+            const sigset_t mask = loopSignalMask();
+            pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+
+            this->running.store(true);
+
+            /* pick up anything posted before the loop started */
+            this->Process();
 
             loop.run(0);
+
+            this->running.store(false);
+        }
+
+        /* calls back on the loop thread whenever fd is readable */
+        void WatchFd(int fd, std::function<void()> callback) {
+            this->UnwatchFd(fd);
+            std::unique_ptr<IoWatcher> watcher(new IoWatcher());
+            watcher->owner = this;
+            watcher->callback = callback;
+            watcher->io.set(loop);
+            watcher->io.set<IoWatcher, &IoWatcher::OnReady>(watcher.get());
+            watcher->io.start(fd, ev::READ);
+            this->watchers[fd] = std::move(watcher);
+        }
+
+        /* calls back on the loop thread when `signal` is raised */
+        void WatchSignal(int signal, std::function<void(int)> callback) {
+            std::unique_ptr<SignalWatcher> watcher(new SignalWatcher());
+            watcher->signal = signal;
+            watcher->callback = callback;
+            watcher->sig.set(loop);
+            watcher->sig.set<SignalWatcher, &SignalWatcher::OnSignal>(watcher.get());
+            watcher->sig.start(signal);
+            this->signalWatchers.push_back(std::move(watcher));
+        }
+
+        void UnwatchFd(int fd) {
+            auto it = this->watchers.find(fd);
+            if (it != this->watchers.end()) {
+                it->second->io.stop();
+                /* may be running its own callback right now; freed the next
+                time any watcher fires */
+                this->retired.push_back(std::move(it->second));
+                this->watchers.erase(it);
+            }
+        }
+
+    protected:
+        virtual void OnDispatchTimeChanged() override {
+            /* posts made by handlers we're currently dispatching are
+            picked up when the timer is re-armed; everything else needs
+            to wake the loop. ev::async coalesces repeated sends. */
+            if (!this->running.load()) {
+                return;
+            }
+            if (std::this_thread::get_id() == this->loopThread && this->dispatching) {
+                return;
+            }
+            wakeup.send();
         }
 
     private:
+        struct IoWatcher {
+            void OnReady(ev::io& io, int revents) {
+                owner->retired.clear();
+                callback();
+            }
+
+            EvMessageQueue* owner;
+            ev::io io;
+            std::function<void()> callback;
+        };
+
+        struct SignalWatcher {
+            void OnSignal(ev::sig& sig, int revents) {
+                callback(signal);
+            }
+
+            int signal;
+            ev::sig sig;
+            std::function<void(int)> callback;
+        };
+
+        void OnWakeup(ev::async& watcher, int revents) {
+            this->Process();
+        }
+
+        void OnTimer(ev::timer& watcher, int revents) {
+            this->Process();
+        }
+
+        void OnQuit(ev::sig& watcher, int revents) {
+            if (handleLoopSignal(SIGTERM)) {
+                loop.break_loop(ev::ALL);
+            }
+        }
+
+        void OnReload(ev::sig& watcher, int revents) {
+            if (handleLoopSignal(RELOAD_SIGNAL)) {
+                loop.break_loop(ev::ALL);
+            }
+        }
+
+        void Process() {
+            this->dispatching = true;
+            this->Dispatch();
+            this->dispatching = false;
+            this->Rearm();
+        }
+
+        void Rearm() {
+            const auto next = this->GetNextMessageTime();
+
+            timer.stop();
+
+            if (next != std::chrono::steady_clock::time_point::max()) {
+                const auto delay = next - this->GetClock()->Now();
+                ev_now_update(loop); /* libev times from its cached "now" */
+                timer.start(std::max(0.0, std::chrono::duration<double>(delay).count()), 0.0);
+            }
+        }
+
         ev::dynamic_loop loop;
-        ev::io io;
+        ev::async wakeup;
+        ev::timer timer;
         ev::sig sio;
+        ev::sig reloadSignal;
+        std::unordered_map<int, std::unique_ptr<IoWatcher>> watchers;
+        std::vector<std::unique_ptr<IoWatcher>> retired;
+        std::vector<std::unique_ptr<SignalWatcher>> signalWatchers;
+        std::atomic<bool> running;
+        std::thread::id loopThread;
+        bool dispatching; /* only touched on the loop thread */
 };
 
-static pid_t getDaemonPid() {
+#endif
+
+/* the lock file holds the pid of the supervisor (or the only process) on
+its first line, followed by the pid of each worker. */
+static std::vector<pid_t> getDaemonPids() {
+    std::vector<pid_t> result;
     std::ifstream lock(instance->LockFilename());
-    if (lock.good()) {
-        int pid;
-        lock >> pid;
-        if (kill((pid_t) pid, 0) == 0) {
-            return pid;
-        }
+    int pid;
+    while (lock.good() && lock >> pid) {
+        result.push_back((pid_t) pid);
+    }
+    return result;
+}
+
+static pid_t getDaemonPid() {
+    const auto pids = getDaemonPids();
+    if (pids.size() && kill(pids.front(), 0) == 0) {
+        return pids.front();
     }
     return NOT_RUNNING;
 }
 
+static bool isAnyRunning(const std::vector<pid_t>& pids) {
+    for (pid_t pid : pids) {
+        if (kill(pid, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void writeLockFile(const std::vector<pid_t>& workers) {
+    /* written to the side and renamed so readers never see a partial list */
+    const std::string filename = instance->LockFilename();
+    const std::string temp = filename + ".tmp";
+    {
+        std::ofstream lock(temp);
+        if (!lock.good()) {
+            return;
+        }
+        lock << std::to_string((int) getpid());
+        for (pid_t pid : workers) {
+            lock << "\n" << std::to_string((int) pid);
+        }
+    }
+    std::rename(temp.c_str(), filename.c_str());
+}
+
 static void stopDaemon() {
     const std::string name = instance->Name();
     pid_t pid = getDaemonPid();
@@ -131,11 +471,14 @@ static void stopDaemon() {
     }
     else {
         std::cout << "\n  stopping " << name << "...";
+        /* the supervisor forwards SIGTERM to its workers; wait for the
+        whole group to go away. */
+        const auto group = getDaemonPids();
         kill(pid, SIGTERM);
         int count = 0;
         bool dead = false;
         while (!dead && count++ < 7) { /* try for 7 seconds */
-            if (kill(pid, 0) == 0) {
+            if (isAnyRunning(group)) {
                 std::cout << ".";
                 std::cout.flush();
                 usleep(500000);
@@ -155,7 +498,9 @@ static void printHelp() {
     std::cout << "\n  "<< instance->Name() << ":\n";
     std::cout << "    --start: start the daemon\n";
     std::cout << "    --foreground: start the in the foreground\n";
-    std::cout << "    --stop: shut down the daemon\n";
+    std::cout << "    --stop: shut down the daemon and its workers\n";
+    std::cout << "    --reload: restart the daemon without closing its listening sockets\n";
+    std::cout << "    --control <command>: run a command on the control socket (try 'help')\n";
     std::cout << "    --running: check if the daemon is running\n";
     std::cout << "    --version: print the version\n";
     std::cout << "    --help: show this message\n\n";
@@ -179,6 +524,12 @@ static void handleCommandLine(int argc, char** argv) {
         else if (command == "--stop") {
             stopDaemon();
         }
+        else if (command == "--reload") {
+            reloadDaemon();
+        }
+        else if (command == "--control") {
+            controlDaemon(argc, argv);
+        }
         else if (command == "--version") {
             std::cout << "\n  " << name << " version: " << version << " " << hash << "\n\n";
         }
@@ -188,7 +539,18 @@ static void handleCommandLine(int argc, char** argv) {
                 std::cout << "\n  " << name << " is NOT running\n\n";
             }
             else {
-                std::cout << "\n  " << name << " is running with pid " << pid << "\n\n";
+                std::cout << "\n  " << name << " is running with pid " << pid;
+                const auto pids = getDaemonPids();
+                if (pids.size() > 1) {
+                    std::cout << ", workers:";
+                    for (size_t i = 1; i < pids.size(); i++) {
+                        std::cout << " " << pids[i];
+                        if (kill(pids[i], 0) != 0) {
+                            std::cout << " (dead)";
+                        }
+                    }
+                }
+                std::cout << "\n\n";
             }
         }
         else {
@@ -200,62 +562,351 @@ static void handleCommandLine(int argc, char** argv) {
 
 static void exitIfRunning() {
     const std::string name = instance->Name();
-    if (getDaemonPid() != NOT_RUNNING) {
+    const pid_t pid = getDaemonPid();
+    if (pid != NOT_RUNNING && pid != reloadParent) {
         std::cerr << "\n " << name << " is already running!\n\n";
         exit(EXIT_SUCCESS);
     }
     std::cerr << "\n  " << name << " is starting...\n\n";
 }
 
-static void signalHandler(int signal) {
-    instance->OnSignal(signal);
+static void startBackground() {
+    /* a replacement started by --reload is already detached, and runs
+    in the old process's working directory (/) */
+    if (reloadParent == NOT_RUNNING) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            exit(EXIT_FAILURE);
+        }
+
+        if (pid > 0) {
+            exit(EXIT_SUCCESS);
+        }
+
+        umask(0);
+
+        pid_t sid = setsid();
+        if (sid < 0) {
+            exit(EXIT_SUCCESS);
+        }
+
+        if (chdir("/") < 0) {
+            exit(EXIT_FAILURE);
+        }
+
+        /* not repeated for a replacement: these slots may now hold
+        listening sockets it inherited */
+        close(STDIN_FILENO);
+        close(STDOUT_FILENO);
+    }
+
+    /* during a reload the lock file keeps naming the old process until
+    the new one is ready to take over; see completeReload() */
+    if (reloadParent == NOT_RUNNING) {
+        writeLockFile({ });
+    }
 }
 
-static void startBackground() {
-    pid_t pid = fork();
+static void startForeground() {
+    if (reloadParent == NOT_RUNNING) {
+        writeLockFile({ });
+    }
+}
 
-    if (pid < 0) {
-        exit(EXIT_FAILURE);
+/* remembers how we were started, so reload() can exec the same command
+line again (picking up a new binary at the same path). */
+static void saveCommandLine(int argc, char** argv) {
+    executable = argv[0];
+    if (executable.find('/') != std::string::npos && executable[0] != '/') {
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd))) {
+            executable = std::string(cwd) + "/" + executable;
+        }
     }
+    arguments.assign(argv, argv + argc);
+}
 
-    if (pid > 0) {
-        exit(EXIT_SUCCESS);
+/* picks up the state handed over by reload() in the old process */
+static void loadReloadState() {
+    const char* pid = getenv(RELOAD_PID_ENV);
+    if (!pid) {
+        return;
+    }
+    reloadParent = (pid_t) atoi(pid);
+    const char* fds = getenv(LISTEN_FDS_ENV);
+    std::string list = fds ? fds : "";
+    size_t offset = 0;
+    while (offset < list.size()) {
+        size_t end = list.find(',', offset);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        listenFds.push_back(atoi(list.substr(offset, end - offset).c_str()));
+        offset = end + 1;
     }
+    unsetenv(RELOAD_PID_ENV);
+    unsetenv(LISTEN_FDS_ENV);
+}
 
-    umask(0);
+/* fork and exec a replacement for this process (or supervisor), handing
+it our listening descriptors. we keep serving until it tells us to go. */
+static char**& environment() {
+#ifdef __APPLE__
+    return *_NSGetEnviron();
+#else
+    return environ;
+#endif
+}
 
-    pid_t sid = setsid();
-    if (sid < 0) {
-        exit(EXIT_SUCCESS);
+static void reload() {
+    if (reloadChild != NOT_RUNNING) {
+        if (waitpid(reloadChild, nullptr, WNOHANG) == 0) {
+            return; /* already in progress */
+        }
+        reloadChild = NOT_RUNNING;
     }
 
-    if (chdir("/") < 0) {
+    /* everything the child needs is built up front; after fork() it only
+    makes async-signal-safe calls (and execvp) */
+    std::string fds;
+    for (int fd : listenFds) {
+        fds += (fds.size() ? "," : "") + std::to_string(fd);
+    }
+    const std::string reloadPid = std::string(RELOAD_PID_ENV) + "=" + std::to_string((int) getpid());
+    const std::string listen = std::string(LISTEN_FDS_ENV) + "=" + fds;
+
+    std::vector<char*> env;
+    for (char** var = environment(); *var; ++var) {
+        env.push_back(*var);
+    }
+    env.push_back(const_cast<char*>(reloadPid.c_str()));
+    env.push_back(const_cast<char*>(listen.c_str()));
+    env.push_back(nullptr);
+
+    std::vector<char*> argv;
+    for (auto& arg : arguments) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        for (int fd : listenFds) {
+            fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+        }
+        /* claimSignals() blocked the loop's signals, and the mask
+        survives exec */
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        environment() = env.data();
+        execvp(executable.c_str(), argv.data());
+        _exit(127);
+    }
+    else if (pid < 0) {
+        std::cerr << "\n  reload failed: couldn't fork\n\n";
+    }
+    else {
+        reloadChild = pid;
+    }
+}
+
+/* called in the replacement once it's ready to serve */
+static void completeReload() {
+    if (reloadParent != NOT_RUNNING) {
+        kill(reloadParent, SIGTERM);
+        reloadParent = NOT_RUNNING;
+    }
+}
+
+/* a replacement supervisor waits until every worker it forked has closed
+its end of the pipe (after OnInit(), or by dying) before taking over. */
+static void awaitWorkers(int fd) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    char buffer[16];
+    while (std::chrono::steady_clock::now() < deadline) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) > 0 && read(fd, buffer, sizeof(buffer)) == 0) {
+            return;
+        }
+    }
+}
+
+/* SIGTERM and RELOAD_SIGNAL as seen by a worker's (or the single
+process's) loop; returns true if the loop should stop. */
+static bool handleLoopSignal(int signal) {
+    if (signal == RELOAD_SIGNAL) {
+        if (supervised) {
+            /* our supervisor is being replaced */
+            draining = true;
+            return true;
+        }
+        reload();
+        return false;
+    }
+    /* SIGTERM while a replacement is starting came from the replacement */
+    draining = draining || reloadChild != NOT_RUNNING;
+    return true;
+}
+
+/* the old side of a reload: stop taking new work, then dispatch whatever
+is already due, for at most a few seconds. */
+static void drain(MessageQueue& queue) {
+    instance->OnDrain();
+    for (int fd : listenFds) {
+        close(fd);
+    }
+    listenFds.clear();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (queue.GetNextMessageTime() <= queue.GetClock()->Now() &&
+        std::chrono::steady_clock::now() < deadline)
+    {
+        queue.Dispatch();
+    }
+}
+
+static std::string controlSocketPath(int worker) {
+    const std::string path = instance->ControlSocketPath();
+    return (path.empty() || !supervised) ? path : path + "." + std::to_string(worker);
+}
+
+static int64_t residentSetBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    int64_t pages = 0, resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * (int64_t) sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return -1;
+}
+
+static int64_t peakResidentSetBytes() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return (int64_t) usage.ru_maxrss; /* bytes */
+#else
+    return (int64_t) usage.ru_maxrss * 1024; /* kilobytes */
+#endif
+}
+
+/* the commands and stats every daemon's control socket answers */
+static void registerControlCommands(ControlChannel& channel, MessageQueue& queue) {
+    channel.RegisterStats("queue", [&queue]() {
+        return queue.GetStats();
+    });
+
+    channel.RegisterStats("process", []() {
+        return nlohmann::json({
+            { "pid", (int) getpid() },
+            { "worker", worker },
+            { "rssBytes", residentSetBytes() },
+            { "peakRssBytes", peakResidentSetBytes() }
+        });
+    });
+
+    channel.RegisterCommand("lag", "loop lag and stalled handlers (needs the watchdog)",
+        [&queue](const ControlChannel::Arguments& args) {
+            if (watchdog) {
+                return watchdog->Stats();
+            }
+            return queue.GetLoopLag().ToJson();
+        });
+
+    channel.RegisterCommand("rss", "resident set size, current and peak, in bytes",
+        [](const ControlChannel::Arguments& args) {
+            return nlohmann::json({
+                { "rssBytes", residentSetBytes() },
+                { "peakRssBytes", peakResidentSetBytes() }
+            });
+        });
+
+    channel.RegisterCommand("loglevel", "get or set the log level: verbose|info|warning|error",
+        [](const ControlChannel::Arguments& args) {
+            static const std::vector<std::string> names = { "verbose", "info", "warning", "error" };
+            if (args.size()) {
+                auto it = std::find(names.begin(), names.end(), args[0]);
+                if (it == names.end()) {
+                    throw std::invalid_argument("unknown log level: " + args[0]);
+                }
+                debug::SetLevel((debug_level) (it - names.begin()));
+            }
+            return nlohmann::json(names.at((size_t) debug::GetLevel()));
+        });
+}
+
+static void controlDaemon(int argc, char** argv) {
+    const std::string name = instance->Name();
+    const pid_t pid = getDaemonPid();
+    if (pid == NOT_RUNNING) {
+        std::cout << "\n  " << name << " is not running\n\n";
         exit(EXIT_FAILURE);
     }
 
-    if (pipe(pipeFd) != 0) {
-        std::cerr << "\n  ERROR! couldn't create pipe\n\n";
+    if (instance->ControlSocketPath().empty()) {
+        std::cout << "\n  " << name << " doesn't have a control socket\n\n";
         exit(EXIT_FAILURE);
     }
 
-    close(STDIN_FILENO);
-    close(STDOUT_FILENO);
+    std::string command;
+    for (int i = 2; i < argc; i++) {
+        command += (command.size() ? " " : "") + std::string(argv[i]);
+    }
+    if (command.empty()) {
+        command = "help";
+    }
 
-    std::ofstream lock(instance->LockFilename());
-    if (lock.good()) {
-        lock << std::to_string((int) getpid());
+    /* one socket per worker when supervised; ask each of them */
+    const size_t workers = getDaemonPids().size() - 1;
+    supervised = workers > 0;
+
+    bool success = true;
+    for (size_t i = 0; i < std::max(workers, (size_t) 1); i++) {
+        std::string response;
+        if (ControlChannel::Send(controlSocketPath((int) i), command, response)) {
+            std::cout << response << "\n";
+        }
+        else {
+            std::cerr << "\n  couldn't reach " << controlSocketPath((int) i) << "\n\n";
+            success = false;
+        }
     }
-}
 
-static void startForeground() {
-    if (pipe(pipeFd) != 0) {
-        std::cerr << "\n  ERROR! couldn't create pipe\n\n";
+    if (!success) {
         exit(EXIT_FAILURE);
     }
+}
 
-    std::ofstream lock(instance->LockFilename());
-    if (lock.good()) {
-        lock << std::to_string((int) getpid());
+static void reloadDaemon() {
+    const std::string name = instance->Name();
+    pid_t pid = getDaemonPid();
+    if (pid == NOT_RUNNING) {
+        std::cout << "\n  " << name << " is not running\n\n";
+        return;
+    }
+    std::cout << "\n  reloading " << name << "...";
+    kill(pid, RELOAD_SIGNAL);
+    int count = 0;
+    pid_t replacement = NOT_RUNNING;
+    while (count++ < 20) { /* the lock file changes hands once OnInit() is done */
+        usleep(500000);
+        replacement = getDaemonPid();
+        if (replacement != NOT_RUNNING && replacement != pid) {
+            break;
+        }
+        std::cout << ".";
+        std::cout.flush();
+    }
+    if (replacement != NOT_RUNNING && replacement != pid) {
+        std::cout << " success, new pid " << replacement << "\n\n";
+    }
+    else {
+        std::cout << " failed\n\n";
+        exit(EXIT_FAILURE);
     }
 }
 
@@ -263,21 +914,365 @@ static void start() {
     type == Type::Foreground ? startForeground() : startBackground();
 }
 
+struct Worker {
+    pid_t pid { NOT_RUNNING };
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point restartAt;
+    std::chrono::milliseconds backoff { 0 };
+};
+
+#ifndef __linux__
+/* there's no sigtimedwait() outside of Linux; the supervisor catches its
+signals with handlers that write to this pipe instead. */
+static int supervisorPipe[2] = { -1, -1 };
+
+static void onSupervisorSignal(int signal) {
+    const int saved = errno;
+    const unsigned char byte = (unsigned char) signal;
+    (void) write(supervisorPipe[1], &byte, 1);
+    errno = saved;
+}
+#endif
+
+/* returns the next signal in `mask` (which is blocked), or -1 if none
+arrived before `timeout` */
+static int waitForSignal(const sigset_t& mask, const timespec& timeout) {
+#ifdef __linux__
+    return sigtimedwait(&mask, nullptr, &timeout);
+#else
+    /* the mask is only opened while we wait; anything caught in the gap
+    before poll() is already sitting in the pipe. */
+    pollfd pfd = { supervisorPipe[0], POLLIN, 0 };
+    const int ms = (int) (timeout.tv_sec * 1000 + (timeout.tv_nsec + 999999) / 1000000);
+    sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+    const int ready = poll(&pfd, 1, ms);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    unsigned char byte = 0;
+    if (ready > 0 && read(supervisorPipe[0], &byte, 1) == 1) {
+        return (int) byte;
+    }
+    return -1;
+#endif
+}
+
+/* forks `count` workers, then waits on signals: SIGCHLD restarts workers
+that died (backing off if they keep dying young), SIGTERM/SIGINT stops the
+group, and anything from GetSignals() is forwarded to every worker. only
+returns in a freshly forked worker; the supervisor exits from here. */
+static void supervise(int count) {
+    using namespace std::chrono;
+
+    std::vector<int> signals = { SIGCHLD, SIGTERM, SIGINT, RELOAD_SIGNAL };
+    for (int signal : instance->GetSignals()) {
+        signals.push_back(signal);
+    }
+
+    sigset_t mask, original;
+    sigemptyset(&mask);
+    for (int signal : signals) {
+        sigaddset(&mask, signal);
+    }
+    sigprocmask(SIG_BLOCK, &mask, &original);
+
+#ifndef __linux__
+    if (pipe(supervisorPipe) == 0) {
+        for (int fd : supervisorPipe) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+        }
+        struct sigaction action = {};
+        action.sa_handler = onSupervisorSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        for (int signal : signals) {
+            sigaction(signal, &action, nullptr);
+        }
+    }
+#endif
+
+    std::vector<Worker> workers(count);
+
+    int ready[2] = { -1, -1 };
+    if (reloadParent != NOT_RUNNING && pipe(ready) != 0) {
+        ready[0] = ready[1] = -1;
+    }
+
+    auto spawn = [&](int index) -> bool {
+        const pid_t pid = fork();
+        if (pid == 0) {
+#ifndef __linux__
+            for (int signal : signals) {
+                std::signal(signal, SIG_DFL);
+            }
+            close(supervisorPipe[0]);
+            close(supervisorPipe[1]);
+#endif
+            sigprocmask(SIG_SETMASK, &original, nullptr);
+#ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGTERM); /* don't outlive the supervisor */
+#endif
+            worker = index;
+            reloadParent = NOT_RUNNING;
+            if (ready[0] >= 0) {
+                close(ready[0]);
+                readyFd = ready[1];
+            }
+            return true;
+        }
+        Worker& w = workers[index];
+        w.started = steady_clock::now();
+        if (pid < 0) {
+            std::cerr << "\n  failed to fork worker " << index << "\n\n";
+            w.pid = NOT_RUNNING;
+            w.restartAt = w.started + seconds(1);
+        }
+        else {
+            w.pid = pid;
+        }
+        return false;
+    };
+
+    auto updateLockFile = [&workers]() {
+        std::vector<pid_t> pids;
+        for (auto& w : workers) {
+            if (w.pid != NOT_RUNNING) {
+                pids.push_back(w.pid);
+            }
+        }
+        writeLockFile(pids);
+    };
+
+    for (int i = 0; i < count; i++) {
+        if (spawn(i)) {
+            return;
+        }
+    }
+
+    updateLockFile();
+
+    if (ready[0] >= 0) {
+        close(ready[1]);
+        awaitWorkers(ready[0]);
+        close(ready[0]);
+        ready[0] = ready[1] = -1;
+    }
+
+    completeReload();
+
+    bool stopping = false;
+    steady_clock::time_point deadline;
+
+    while (true) {
+        auto now = steady_clock::now();
+        auto wake = now + seconds(1);
+        if (stopping) {
+            wake = std::min(wake, deadline);
+        }
+        else {
+            for (auto& w : workers) {
+                if (w.pid == NOT_RUNNING) {
+                    wake = std::min(wake, w.restartAt);
+                }
+            }
+        }
+
+        const int64_t timeout = std::max(
+            (int64_t) 0, (int64_t) duration_cast<nanoseconds>(wake - now).count());
+        timespec ts;
+        ts.tv_sec = (time_t) (timeout / 1000000000);
+        ts.tv_nsec = (long) (timeout % 1000000000);
+
+        const int signal = waitForSignal(mask, ts);
+
+        if (signal == SIGTERM || signal == SIGINT) {
+            if (!stopping) {
+                /* if our replacement sent this, let the workers drain */
+                const bool replaced = reloadChild != NOT_RUNNING;
+                stopping = true;
+                deadline = steady_clock::now() + seconds(replaced ? 7 : 3);
+                for (auto& w : workers) {
+                    if (w.pid != NOT_RUNNING) {
+                        kill(w.pid, replaced ? RELOAD_SIGNAL : SIGTERM);
+                    }
+                }
+            }
+        }
+        else if (signal == RELOAD_SIGNAL) {
+            if (!stopping) {
+                reload();
+            }
+        }
+        else if (signal > 0 && signal != SIGCHLD) {
+            for (auto& w : workers) {
+                if (w.pid != NOT_RUNNING) {
+                    kill(w.pid, signal);
+                }
+            }
+        }
+
+        /* reap on every pass; SIGCHLD doesn't queue, so one delivery may
+        stand for several exits. */
+        bool changed = false;
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == reloadChild) {
+                std::cerr << "\n  reload failed: the new process exited\n\n";
+                reloadChild = NOT_RUNNING;
+            }
+            for (int i = 0; i < count; i++) {
+                Worker& w = workers[i];
+                if (w.pid != pid) {
+                    continue;
+                }
+                w.pid = NOT_RUNNING;
+                changed = true;
+                if (!stopping) {
+                    const auto uptime = steady_clock::now() - w.started;
+                    w.backoff = uptime < seconds(5)
+                        ? std::min(std::max(w.backoff * 2, milliseconds(500)), milliseconds(30000))
+                        : milliseconds(0);
+                    w.restartAt = steady_clock::now() + w.backoff;
+                    std::cerr << "\n  worker " << i << " (pid " << pid << ") ";
+                    if (WIFSIGNALED(status)) {
+                        std::cerr << "killed by signal " << WTERMSIG(status);
+                    }
+                    else {
+                        std::cerr << "exited with status " << WEXITSTATUS(status);
+                    }
+                    std::cerr << ", restarting in " << w.backoff.count() << "ms\n\n";
+                }
+            }
+        }
+
+        now = steady_clock::now();
+
+        if (stopping) {
+            bool alive = false;
+            for (auto& w : workers) {
+                alive = alive || w.pid != NOT_RUNNING;
+            }
+            if (!alive) {
+                break;
+            }
+            if (now >= deadline) {
+                for (auto& w : workers) {
+                    if (w.pid != NOT_RUNNING) {
+                        kill(w.pid, SIGKILL);
+                    }
+                }
+                deadline = now + seconds(1);
+            }
+        }
+        else {
+            for (int i = 0; i < count; i++) {
+                if (workers[i].pid == NOT_RUNNING && workers[i].restartAt <= now) {
+                    if (spawn(i)) {
+                        return;
+                    }
+                    changed = true;
+                }
+            }
+            if (changed) {
+                updateLockFile();
+            }
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
 } } } /* namespace f8n::daemon::internal */
 
 namespace f8n { namespace daemon {
     static void start(int argc, char** argv, Daemon& instance) {
         internal::instance = &instance;
+        internal::saveCommandLine(argc, argv);
+        internal::loadReloadState();
         internal::handleCommandLine(argc, argv);
         internal::exitIfRunning();
+        internal::claimSignals();
         internal::start();
-        for (int signal : instance.GetSignals()) {
-            std::signal(signal, internal::signalHandler);
+        if (internal::reloadParent == internal::NOT_RUNNING) {
+            internal::listenFds = instance.OnListen();
+        }
+        if (instance.WorkerCount() > 1) {
+            internal::supervised = true;
+            internal::supervise(instance.WorkerCount()); /* returns in workers */
+            internal::claimSignals(); /* the supervisor may have replaced our handlers */
         }
+        instance.OnWorkerInit(internal::worker, internal::listenFds);
         {
+#ifdef F8N_DAEMON_USE_EPOLL
+            EpollMessageQueue messageQueue;
+            internal::SignalDispatcher signals(messageQueue);
+
+            /* already blocked by claimSignals(); anything that arrived
+            since is still pending, and is read from here on */
+            messageQueue.WatchSignals(internal::loopSignals(), [&messageQueue, &signals](int signal) {
+                if (!internal::isReservedSignal(signal)) {
+                    signals.Raise(signal);
+                }
+                else if (internal::handleLoopSignal(signal)) {
+                    messageQueue.Quit();
+                }
+            });
+#else
             internal::EvMessageQueue messageQueue;
+            internal::SignalDispatcher signals(messageQueue);
+
+            /* libev catches these itself and reports them on the loop */
+            for (int signal : instance.GetSignals()) {
+                if (!internal::isReservedSignal(signal)) {
+                    messageQueue.WatchSignal(signal, [&signals](int signal) {
+                        signals.Raise(signal);
+                    });
+                }
+            }
+#endif
+            if (instance.WatchdogThresholdMs() > 0) {
+                internal::watchdog.reset(new Watchdog(
+                    messageQueue, std::chrono::milliseconds(instance.WatchdogThresholdMs())));
+            }
+            std::unique_ptr<ControlChannel> control;
+            const std::string controlPath = internal::controlSocketPath(internal::worker);
+            if (controlPath.size()) {
+                control.reset(new ControlChannel(
+#ifdef F8N_DAEMON_USE_EPOLL
+                    [&messageQueue](int fd, std::function<void()> readable) {
+                        messageQueue.WatchFd(fd, EPOLLIN, [readable](int fd, uint32_t events) {
+                            readable();
+                        });
+                    },
+#else
+                    [&messageQueue](int fd, std::function<void()> readable) {
+                        messageQueue.WatchFd(fd, readable);
+                    },
+#endif
+                    [&messageQueue](int fd) {
+                        messageQueue.UnwatchFd(fd);
+                    }));
+                internal::registerControlCommands(*control, messageQueue);
+                instance.OnControl(*control);
+                if (!control->Listen(controlPath)) {
+                    std::cerr << "\n  couldn't listen on " << controlPath << "\n\n";
+                }
+            }
             instance.OnInit(internal::type, messageQueue);
+            if (!internal::supervised && internal::reloadParent != internal::NOT_RUNNING) {
+                internal::writeLockFile({ });
+                internal::completeReload();
+            }
+            if (internal::readyFd >= 0) {
+                close(internal::readyFd);
+                internal::readyFd = -1;
+            }
             messageQueue.Run();
+            if (internal::draining) {
+                internal::drain(messageQueue);
+            }
+            control.reset();
+            internal::watchdog.reset();
         }
         instance.OnDeinit();
     }
@@ -41,7 +41,10 @@ using namespace f8n::utf;
 
 Connection::Connection()
 : connection(nullptr)
-, transactionCounter(0) {
+, transactionCounter(0)
+, nestedTransactionCanceled(false)
+, statementCacheSize(DefaultStatementCacheSize)
+, statementCacheStats() {
     this->UpdateReferenceCount(true);
 }
 
@@ -53,12 +56,19 @@ Connection::~Connection() {
 int Connection::Open(const std::string &database, unsigned int options, unsigned int cache) {
     int error;
 
+    if (options != 0) {
+        /* `options` are SQLITE_OPEN_* flags; sqlite3_open_v2 always takes
+        utf8, on every platform */
+        error = sqlite3_open_v2(database.c_str(), &this->connection, (int) options, nullptr);
+    }
+    else {
     #ifdef WIN32
         std::wstring wdatabase = u8to16(database);
         error = sqlite3_open16(wdatabase.c_str(), &this->connection);
     #else
         error = sqlite3_open(database.c_str(), &this->connection);
     #endif
+    }
 
     if (error == SQLITE_OK) {
         this->Initialize(cache);
@@ -68,6 +78,12 @@ int Connection::Open(const std::string &database, unsigned int options, unsigned
 }
 
 int Connection::Close() {
+    {
+        /* cached statements would otherwise keep the database open */
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->TrimStatementCache(0);
+    }
+
     if (sqlite3_close(this->connection) == SQLITE_OK) {
         this->connection = 0;
         return Okay;
@@ -83,22 +99,97 @@ int Connection::Execute(const char* sql) {
     {
         std::unique_lock<std::mutex> lock(this->mutex);
 
-        if (sqlite3_prepare_v2(this->connection, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            sqlite3_finalize(stmt);
+        stmt = this->AcquireStatement(sql);
+        if (!stmt) {
             return Error;
         }
     }
 
     int error = this->StepStatement(stmt);
+
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->ReleaseStatement(sql, stmt);
+    }
+
     if (error != SQLITE_OK && error != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
         return Error;
     }
 
+    return Okay;
+}
+
+void Connection::SetStatementCacheSize(size_t size) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->statementCacheSize = size;
+    this->TrimStatementCache(size);
+}
+
+StatementCacheStats Connection::GetStatementCacheStats() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    StatementCacheStats result = this->statementCacheStats;
+    result.size = this->statements.size();
+    result.capacity = this->statementCacheSize;
+    return result;
+}
+
+sqlite3_stmt* Connection::AcquireStatement(const char* sql) {
+    /* a cached statement is checked out exclusively; if the same sql is
+    in use twice at once, the second user gets a fresh one. */
+    auto it = this->statementIndex.find(sql);
+    if (it != this->statementIndex.end()) {
+        sqlite3_stmt* stmt = it->second->stmt;
+        this->statements.erase(it->second);
+        this->statementIndex.erase(it);
+        ++this->statementCacheStats.hits;
+        return stmt;
+    }
+
+    ++this->statementCacheStats.misses;
+
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(this->connection, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+void Connection::ReleaseStatement(const std::string& sql, sqlite3_stmt* stmt) {
+    if (!stmt) {
+        return;
+    }
+
     sqlite3_reset(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_clear_bindings(stmt);
 
-    return Okay;
+    /* keyed by the exact text the caller acquired it with, not by
+    sqlite3_sql(), which drops anything after the first statement (e.g.
+    a trailing newline) and would never match the next lookup. */
+    if (this->statementCacheSize == 0 ||
+        sql.empty() ||
+        sqlite3_db_handle(stmt) != this->connection ||
+        this->statementIndex.find(sql) != this->statementIndex.end())
+    {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    this->statements.push_front({ sql, stmt });
+    this->statementIndex[this->statements.front().sql] = this->statements.begin();
+    this->TrimStatementCache(this->statementCacheSize);
+}
+
+void Connection::TrimStatementCache(size_t size) {
+    while (this->statements.size() > size) {
+        CachedStatement& oldest = this->statements.back();
+        sqlite3_finalize(oldest.stmt);
+        this->statementIndex.erase(oldest.sql);
+        this->statements.pop_back();
+        if (size > 0) {
+            ++this->statementCacheStats.evictions;
+        }
+    }
 }
 
 void Connection::Checkpoint() {
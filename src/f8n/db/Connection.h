@@ -38,8 +38,11 @@
 #include <f8n/db/Statement.h>
 #include <f8n/db/ScopedTransaction.h>
 
+#include <list>
 #include <map>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 struct sqlite3;
 struct sqlite3_stmt;
@@ -53,6 +56,14 @@ namespace f8n { namespace db {
         Error = 1
     } ReturnCode;
 
+    struct StatementCacheStats {
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+        size_t size;
+        size_t capacity;
+    };
+
     class Connection {
         public:
             Connection();
@@ -70,17 +81,44 @@ namespace f8n { namespace db {
             void Interrupt();
             void Checkpoint();
 
+            /* prepared statements are kept in a small LRU cache keyed by
+            their sql text, and reused by Statement and Execute(). a size
+            of 0 disables the cache. */
+            void SetStatementCacheSize(size_t size);
+            StatementCacheStats GetStatementCacheStats();
+
+            static const size_t DefaultStatementCacheSize = 64;
+
         private:
+            struct CachedStatement {
+                std::string sql;
+                sqlite3_stmt* stmt;
+            };
+
+            using StatementList = std::list<CachedStatement>;
+
             void Initialize(unsigned int cache);
             void UpdateReferenceCount(bool init);
             int StepStatement(sqlite3_stmt *stmt);
 
+            /* both expect `mutex` to be held */
+            sqlite3_stmt* AcquireStatement(const char* sql);
+            void ReleaseStatement(const std::string& sql, sqlite3_stmt* stmt);
+            void TrimStatementCache(size_t size);
+
             friend class Statement;
             friend class ScopedTransaction;
+            friend class WriteBatcher;
 
             int transactionCounter;
+            bool nestedTransactionCanceled; /* see WriteBatcher::RunBatch() */
             sqlite3 *connection;
             std::mutex mutex;
+
+            StatementList statements; /* most recently used first */
+            std::unordered_map<std::string, StatementList::iterator> statementIndex;
+            size_t statementCacheSize;
+            StatementCacheStats statementCacheStats;
     };
 
 } }
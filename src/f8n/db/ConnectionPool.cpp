@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/db/ConnectionPool.h>
+#include <sqlite/sqlite3.h>
+
+using namespace f8n::db;
+
+using Lease = ConnectionPool::Lease;
+
+Lease::Lease(ConnectionPool* pool, Connection* connection)
+: pool(pool)
+, connection(connection) {
+}
+
+Lease::Lease(Lease&& other)
+: pool(other.pool)
+, connection(other.connection) {
+    other.pool = nullptr;
+    other.connection = nullptr;
+}
+
+Lease::~Lease() {
+    if (this->pool) {
+        this->pool->Return(this->connection);
+    }
+}
+
+ConnectionPool::ConnectionPool()
+: writerIdle(false)
+, leases(0) {
+}
+
+ConnectionPool::~ConnectionPool() {
+    this->Close();
+}
+
+int ConnectionPool::Open(const std::string& database, size_t readers, unsigned int cache) {
+    this->Close();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    /* private caches: shared-cache mode would serialize every connection
+    on table-level locks, which defeats the point. */
+    const unsigned int writerFlags =
+        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_PRIVATECACHE;
+
+    const unsigned int readerFlags =
+        SQLITE_OPEN_READONLY | SQLITE_OPEN_PRIVATECACHE;
+
+    this->writer.reset(new Connection());
+    int error = this->writer->Open(database, writerFlags, cache);
+    if (error != Okay) {
+        this->writer.reset();
+        return error;
+    }
+
+    for (size_t i = 0; i < readers; i++) {
+        std::unique_ptr<Connection> reader(new Connection());
+        error = reader->Open(database, readerFlags, cache);
+        if (error != Okay) {
+            this->readers.clear();
+            this->writer.reset();
+            return error;
+        }
+        this->idleReaders.push_back(reader.get());
+        this->readers.push_back(std::move(reader));
+    }
+
+    this->writerIdle = true;
+    return Okay;
+}
+
+void ConnectionPool::Close() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->leases > 0) {
+        this->available.wait(lock);
+    }
+    this->idleReaders.clear();
+    this->readers.clear();
+    this->writer.reset();
+    this->writerIdle = false;
+}
+
+Lease ConnectionPool::Read() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->readers.empty()) {
+        lock.unlock();
+        return this->Write();
+    }
+
+    while (this->idleReaders.empty()) {
+        this->available.wait(lock);
+    }
+
+    Connection* connection = this->idleReaders.back();
+    this->idleReaders.pop_back();
+    ++this->leases;
+    return Lease(this, connection);
+}
+
+Lease ConnectionPool::Write() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (!this->writerIdle) {
+        this->available.wait(lock);
+    }
+
+    this->writerIdle = false;
+    ++this->leases;
+    return Lease(this, this->writer.get());
+}
+
+size_t ConnectionPool::ReaderCount() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->readers.size();
+}
+
+void ConnectionPool::Return(Connection* connection) {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (connection == this->writer.get()) {
+            this->writerIdle = true;
+        }
+        else {
+            this->idleReaders.push_back(connection);
+        }
+        --this->leases;
+    }
+    /* readers, the writer and Close() all wait on the same condition */
+    this->available.notify_all();
+}
@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/config.h>
+#include <f8n/db/Connection.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace f8n { namespace db {
+
+    /* one writer connection and a set of read-only readers, all opened
+    with a private page cache. with write-ahead logging enabled readers
+    see the last committed snapshot and never wait on the writer, so read
+    queries scale across threads while a write is in progress. connections
+    are checked out with a Lease, per thread or per task, and returned
+    when it goes out of scope. */
+    class ConnectionPool {
+        public:
+            class Lease {
+                public:
+                    Lease(Lease&& other);
+                    Lease(const Lease&) = delete;
+                    Lease& operator=(const Lease&) = delete;
+                    ~Lease();
+
+                    Connection& operator*() { return *this->connection; }
+                    Connection* operator->() { return this->connection; }
+                    Connection& Get() { return *this->connection; }
+
+                private:
+                    friend class ConnectionPool;
+
+                    Lease(ConnectionPool* pool, Connection* connection);
+
+                    ConnectionPool* pool;
+                    Connection* connection;
+            };
+
+            ConnectionPool();
+            ConnectionPool(const ConnectionPool&) = delete;
+            ~ConnectionPool();
+
+            /* opens the writer first (creating the database and switching
+            it to WAL if need be), then `readers` readers. with no readers,
+            Read() hands out the writer. */
+            int Open(const std::string& database, size_t readers, unsigned int cache = 0);
+
+            /* waits for every outstanding lease to be returned */
+            void Close();
+
+            /* both block until a suitable connection is free; the pool must
+            be open. */
+            Lease Read();
+            Lease Write();
+
+            size_t ReaderCount();
+
+        private:
+            void Return(Connection* connection);
+
+            std::mutex mutex;
+            std::condition_variable available;
+            std::unique_ptr<Connection> writer;
+            std::vector<std::unique_ptr<Connection>> readers;
+            std::vector<Connection*> idleReaders;
+            bool writerIdle;
+            size_t leases;
+    };
+
+} }
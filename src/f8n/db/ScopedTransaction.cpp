@@ -62,6 +62,7 @@ void ScopedTransaction::Begin() {
     and also allows reads while writing */
     if (this->connection->transactionCounter == 0) {
         this->connection->Execute("BEGIN IMMEDIATE TRANSACTION");
+        this->connection->nestedTransactionCanceled = false;
     }
 
     ++this->connection->transactionCounter;
@@ -79,6 +80,11 @@ void ScopedTransaction::End() {
             //this->connection->Checkpoint();
         }
     }
+    else if (this->canceled) {
+        /* a nested transaction can't roll back on its own; whoever owns
+        the outermost one may want to know. */
+        this->connection->nestedTransactionCanceled = true;
+    }
 
     this->canceled = false;
 }
@@ -41,12 +41,11 @@ using namespace f8n::db;
 
 Statement::Statement(const char* sql, Connection &connection)
 : connection(&connection)
+, sql(sql)
 , stmt(nullptr)
 , modifiedRows(0) {
     std::unique_lock<std::mutex> lock(connection.mutex);
-
-    sqlite3_prepare_v2(
-        this->connection->connection, sql, -1, &this->stmt, nullptr);
+    this->stmt = connection.AcquireStatement(sql);
 }
 
 Statement::Statement(Connection &connection)
@@ -55,7 +54,9 @@ Statement::Statement(Connection &connection)
 }
 
 Statement::~Statement() {
-    sqlite3_finalize(this->stmt);
+    /* reset, unbound, and handed back to the connection's cache */
+    std::unique_lock<std::mutex> lock(this->connection->mutex);
+    this->connection->ReleaseStatement(this->sql, this->stmt);
 }
 
 void Statement::Reset() {
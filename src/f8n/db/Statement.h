@@ -76,6 +76,7 @@ namespace f8n { namespace db {
 
             Statement(Connection &connection);
 
+            std::string sql; /* the statement cache key */
             sqlite3_stmt *stmt;
             Connection *connection;
             int modifiedRows;
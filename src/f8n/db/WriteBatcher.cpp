@@ -0,0 +1,246 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/db/WriteBatcher.h>
+#include <f8n/db/ConnectionPool.h>
+
+#include <algorithm>
+#include <exception>
+#include <vector>
+
+using namespace f8n::db;
+
+WriteBatcher::WriteBatcher(
+    Connection& connection,
+    size_t maxBatchSize,
+    std::chrono::microseconds maxDelay)
+: connection(&connection)
+, pool(nullptr)
+, maxBatchSize(std::max((size_t) 1, maxBatchSize))
+, maxDelay(maxDelay)
+, submittedCount(0)
+, completedCount(0)
+, flushTarget(0)
+, stopping(false)
+, stats() {
+    this->thread = std::thread(&WriteBatcher::ThreadProc, this);
+}
+
+WriteBatcher::WriteBatcher(
+    ConnectionPool& pool,
+    size_t maxBatchSize,
+    std::chrono::microseconds maxDelay)
+: connection(nullptr)
+, pool(&pool)
+, maxBatchSize(std::max((size_t) 1, maxBatchSize))
+, maxDelay(maxDelay)
+, submittedCount(0)
+, completedCount(0)
+, flushTarget(0)
+, stopping(false)
+, stats() {
+    this->thread = std::thread(&WriteBatcher::ThreadProc, this);
+}
+
+WriteBatcher::~WriteBatcher() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->pending.notify_all();
+    this->thread.join();
+}
+
+std::future<bool> WriteBatcher::Submit(Write write) {
+    Pending entry;
+    entry.write = std::move(write);
+    entry.submitted = std::chrono::steady_clock::now();
+    std::future<bool> result = entry.promise.get_future();
+
+    bool wake;
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->queue.push_back(std::move(entry));
+        ++this->submittedCount;
+        /* the writer only needs a nudge for the first write of a batch,
+        and when a batch fills up */
+        wake = this->queue.size() == 1 || this->queue.size() >= this->maxBatchSize;
+    }
+
+    if (wake) {
+        this->pending.notify_one();
+    }
+
+    return result;
+}
+
+std::future<bool> WriteBatcher::Submit(const std::string& sql, Binder bind) {
+    return this->Submit([sql, bind](Connection& connection) {
+        Statement statement(sql.c_str(), connection);
+        if (bind) {
+            bind(statement);
+        }
+        return statement.Step() == Done;
+    });
+}
+
+void WriteBatcher::Flush() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    const uint64_t target = this->submittedCount;
+    this->flushTarget = std::max(this->flushTarget, target);
+    this->pending.notify_one();
+    while (this->completedCount < target) {
+        this->completed.wait(lock);
+    }
+}
+
+WriteBatcherStats WriteBatcher::GetStats() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void WriteBatcher::ThreadProc() {
+    std::deque<Pending> batch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+
+            while (this->queue.empty() && !this->stopping) {
+                this->pending.wait(lock);
+            }
+
+            if (this->queue.empty()) {
+                return; /* stopping, and nothing left to write */
+            }
+
+            /* give the batch until `maxDelay` after its oldest write to
+            fill up; a backlog that's already old enough goes right away,
+            as does everything once someone is waiting in Flush(). */
+            const auto deadline = this->queue.front().submitted + this->maxDelay;
+            while (!this->stopping &&
+                this->queue.size() < this->maxBatchSize &&
+                this->flushTarget <= this->completedCount &&
+                std::chrono::steady_clock::now() < deadline)
+            {
+                this->pending.wait_until(lock, deadline);
+            }
+
+            const size_t count = std::min(this->queue.size(), this->maxBatchSize);
+            for (size_t i = 0; i < count; i++) {
+                batch.push_back(std::move(this->queue.front()));
+                this->queue.pop_front();
+            }
+        }
+
+        if (this->pool) {
+            auto writer = this->pool->Write();
+            this->RunBatch(*writer, batch);
+        }
+        else {
+            this->RunBatch(*this->connection, batch);
+        }
+
+        batch.clear();
+    }
+}
+
+void WriteBatcher::RunBatch(Connection& connection, std::deque<Pending>& batch) {
+    std::vector<bool> succeeded(batch.size(), false);
+    std::vector<std::exception_ptr> errors(batch.size());
+
+    bool committed = false;
+
+    if (connection.Execute("BEGIN IMMEDIATE TRANSACTION") == Okay) {
+        /* writes that open their own ScopedTransaction join ours */
+        ++connection.transactionCounter;
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (connection.Execute("SAVEPOINT f8n_write_batch") != Okay) {
+                continue;
+            }
+
+            connection.nestedTransactionCanceled = false;
+
+            try {
+                succeeded[i] = batch[i].write(connection);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+
+            /* a write that opened its own ScopedTransaction and canceled
+            it expects its changes to be rolled back */
+            if (connection.nestedTransactionCanceled) {
+                succeeded[i] = false;
+            }
+
+            if (!succeeded[i]) {
+                connection.Execute("ROLLBACK TO SAVEPOINT f8n_write_batch");
+            }
+
+            connection.Execute("RELEASE SAVEPOINT f8n_write_batch");
+        }
+
+        --connection.transactionCounter;
+
+        committed = connection.Execute("COMMIT TRANSACTION") == Okay;
+        if (!committed) {
+            connection.Execute("ROLLBACK TRANSACTION");
+        }
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (errors[i]) {
+            batch[i].promise.set_exception(errors[i]);
+            ++failed;
+        }
+        else {
+            batch[i].promise.set_value(committed && succeeded[i]);
+            failed += (committed && succeeded[i]) ? 0 : 1;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        ++this->stats.batches;
+        this->stats.writes += batch.size();
+        this->stats.failed += failed;
+        this->stats.largestBatch = std::max(this->stats.largestBatch, batch.size());
+        this->completedCount += batch.size();
+    }
+
+    this->completed.notify_all();
+}
@@ -0,0 +1,132 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/config.h>
+#include <f8n/db/Connection.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace f8n { namespace db {
+
+    class ConnectionPool;
+
+    struct WriteBatcherStats {
+        size_t batches;
+        size_t writes;
+        size_t failed;
+        size_t largestBatch;
+    };
+
+    /* group commit for many small writes from many threads. writes are
+    queued and run on a single writer thread, many per transaction: while
+    one batch commits, the next one collects everything submitted in the
+    meantime. a batch closes when it reaches `maxBatchSize` writes, or
+    `maxDelay` after its first write was submitted, whichever comes first;
+    the default delay of zero adds no latency to an idle writer. each write
+    runs inside its own SAVEPOINT, so one that fails (returns false,
+    throws, or Cancel()s a ScopedTransaction it opened) is rolled back
+    without taking the rest of the batch with it.
+    a write's future resolves once its batch has committed.
+
+    the connection must not be used by anything else while the batcher
+    is alive; with a ConnectionPool the writer is leased per batch. */
+    class WriteBatcher {
+        public:
+            using Write = std::function<bool(Connection&)>;
+            using Binder = std::function<void(Statement&)>;
+
+            WriteBatcher(
+                Connection& connection,
+                size_t maxBatchSize = 256,
+                std::chrono::microseconds maxDelay = std::chrono::microseconds(0));
+
+            WriteBatcher(
+                ConnectionPool& pool,
+                size_t maxBatchSize = 256,
+                std::chrono::microseconds maxDelay = std::chrono::microseconds(0));
+
+            WriteBatcher(const WriteBatcher&) = delete;
+
+            /* commits everything already submitted */
+            ~WriteBatcher();
+
+            std::future<bool> Submit(Write write);
+
+            /* prepares `sql`, lets `bind` fill in its parameters, and steps
+            it once; succeeds if the statement runs to completion. */
+            std::future<bool> Submit(const std::string& sql, Binder bind);
+
+            /* blocks until every write submitted before the call has been
+            committed (or has failed) */
+            void Flush();
+
+            WriteBatcherStats GetStats();
+
+        private:
+            struct Pending {
+                Write write;
+                std::promise<bool> promise;
+                std::chrono::steady_clock::time_point submitted;
+            };
+
+            void ThreadProc();
+            void RunBatch(Connection& connection, std::deque<Pending>& batch);
+
+            Connection* connection;
+            ConnectionPool* pool;
+            size_t maxBatchSize;
+            std::chrono::microseconds maxDelay;
+
+            std::mutex mutex;
+            std::condition_variable pending;
+            std::condition_variable completed;
+            std::deque<Pending> queue;
+            uint64_t submittedCount;
+            uint64_t completedCount;
+            uint64_t flushTarget;
+            bool stopping;
+            WriteBatcherStats stats;
+            std::thread thread;
+    };
+
+} }
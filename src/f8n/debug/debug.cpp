@@ -34,6 +34,7 @@
 
 #include <f8n/debug/debug.h>
 #include <f8n/environment/Environment.h>
+#include <atomic>
 #include <functional>
 #include <string>
 #include <queue>
@@ -53,13 +54,7 @@ static std::thread* thread = nullptr;
 static log_queue* queue = nullptr;
 static std::recursive_mutex mutex;
 static volatile bool cancel = true;
-
-enum class debug_level {
-    verbose = 0,
-    info = 1,
-    warning = 2,
-    error = 3
-};
+static std::atomic<int> minimumLevel(0);
 
 class log_queue {
     public:
@@ -200,6 +195,10 @@ void debug::Stop() {
 }
 
 static void enqueue(debug_level level, const std::string& tag, const std::string& string) {
+    if ((int) level < minimumLevel.load(std::memory_order_relaxed)) {
+        return;
+    }
+
     std::unique_lock<std::recursive_mutex> lock(mutex);
 
     if (queue) {
@@ -207,6 +206,14 @@ static void enqueue(debug_level level, const std::string& tag, const std::string
     }
 }
 
+void debug::SetLevel(debug_level level) {
+    minimumLevel.store((int) level, std::memory_order_relaxed);
+}
+
+debug_level debug::GetLevel() {
+    return (debug_level) minimumLevel.load(std::memory_order_relaxed);
+}
+
 void debug::verbose(const std::string& tag, const std::string& string) {
     enqueue(debug_level::verbose, tag, string);
 }
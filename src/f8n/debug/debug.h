@@ -40,6 +40,13 @@
 #include <memory>
 
 namespace f8n {
+    enum class debug_level {
+        verbose = 0,
+        info = 1,
+        warning = 2,
+        error = 3
+    };
+
     class debug {
         public:
             class IBackend {
@@ -84,6 +91,10 @@ namespace f8n {
             static void Start(std::vector<IBackend*> backends = { new SimpleFileBackend() });
             static void Stop();
 
+            /* messages below this level are discarded before they're queued */
+            static void SetLevel(debug_level level);
+            static debug_level GetLevel();
+
             static void verbose(const std::string& tag, const std::string& string);
             static void v(const std::string& tag, const std::string& string);
             static void info(const std::string& tag, const std::string& string);
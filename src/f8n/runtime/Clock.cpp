@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/Clock.h>
+
+using namespace std::chrono;
+using namespace f8n::runtime;
+
+IClockPtr SteadyClock::Instance() {
+    static IClockPtr instance = std::make_shared<SteadyClock>();
+    return instance;
+}
+
+steady_clock::time_point SteadyClock::Now() {
+    return steady_clock::now();
+}
+
+VirtualClock::VirtualClock(steady_clock::time_point start) {
+    this->ticks.store(start.time_since_epoch().count());
+}
+
+steady_clock::time_point VirtualClock::Now() {
+    return steady_clock::time_point(steady_clock::duration(this->ticks.load()));
+}
+
+void VirtualClock::Set(steady_clock::time_point time) {
+    const int64_t target = time.time_since_epoch().count();
+    int64_t current = this->ticks.load();
+    while (current < target && !this->ticks.compare_exchange_weak(current, target)) {
+    }
+}
+
+void VirtualClock::Advance(steady_clock::duration duration) {
+    if (duration.count() > 0) {
+        this->ticks.fetch_add(duration.count());
+    }
+}
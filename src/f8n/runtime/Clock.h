@@ -0,0 +1,70 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/IClock.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace f8n { namespace runtime {
+
+    /* the real thing; what queues use unless told otherwise */
+    class SteadyClock : public IClock {
+        public:
+            static IClockPtr Instance();
+
+            virtual std::chrono::steady_clock::time_point Now() override;
+    };
+
+    /* a clock that only moves when told to. lets tests and load replays
+    drive a queue through hours of timer traffic as fast as the CPU
+    allows, with fully deterministic ordering. time never moves backwards:
+    Set() to an earlier time is ignored. */
+    class VirtualClock : public IClock {
+        public:
+            VirtualClock(std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::time_point());
+
+            virtual std::chrono::steady_clock::time_point Now() override;
+
+            void Set(std::chrono::steady_clock::time_point time);
+            void Advance(std::chrono::steady_clock::duration duration);
+
+        private:
+            std::atomic<int64_t> ticks;
+    };
+
+} }
@@ -0,0 +1,248 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+/* coroutine support requires a C++20 compiler. the rest of the library
+builds as C++17, so this header is empty unless coroutines are available. */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <f8n/runtime/IMessageQueue.h>
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/Pool.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+
+namespace f8n { namespace runtime {
+
+    /* coroutine frames are carved out of size-classed BlockPools; the
+    (rare) frames larger than the biggest class come from the heap. */
+    class CoroutineFrame {
+        public:
+            static void* Allocate(size_t size) {
+                if (size <= 256) { return BlockPool<256, Alignment>::Allocate(); }
+                if (size <= 512) { return BlockPool<512, Alignment>::Allocate(); }
+                if (size <= 1024) { return BlockPool<1024, Alignment>::Allocate(); }
+                if (size <= 2048) { return BlockPool<2048, Alignment>::Allocate(); }
+                return ::operator new(size);
+            }
+
+            static void Deallocate(void* frame, size_t size) {
+                if (size <= 256) { BlockPool<256, Alignment>::Deallocate(frame); }
+                else if (size <= 512) { BlockPool<512, Alignment>::Deallocate(frame); }
+                else if (size <= 1024) { BlockPool<1024, Alignment>::Deallocate(frame); }
+                else if (size <= 2048) { BlockPool<2048, Alignment>::Deallocate(frame); }
+                else { ::operator delete(frame); }
+            }
+
+        private:
+            static const size_t Alignment = alignof(std::max_align_t);
+    };
+
+    /* binds coroutines to an IMessageQueue. every resumption is posted to
+    the queue as a regular message, so resumed coroutines interleave with
+    other messages in the queue's usual (time, sequence) order, on whichever
+    thread dispatches the queue. a Scheduler must outlive the Post() calls
+    made through it; coroutines still suspended on it when it is destroyed
+    are destroyed along with it. */
+    class Scheduler : public IMessageTarget {
+        private:
+            /* links a suspended coroutine into its scheduler's list. it
+            lives in the awaiter, which lives in the coroutine frame for
+            exactly as long as the coroutine is suspended, so tracking a
+            suspension costs no allocation. */
+            struct Suspension {
+                std::coroutine_handle<> handle;
+                Suspension* prev { nullptr };
+                Suspension* next { nullptr };
+            };
+
+        public:
+            class Awaitable {
+                public:
+                    Awaitable(Scheduler& scheduler, int64_t delayMs)
+                    : scheduler(scheduler), delayMs(delayMs) {
+                    }
+
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    void await_suspend(std::coroutine_handle<> handle) {
+                        /* the coroutine may be resumed on another thread
+                        before this returns; don't touch `this` after. */
+                        this->suspension.handle = handle;
+                        this->scheduler.Suspend(this->suspension, this->delayMs);
+                    }
+
+                    void await_resume() const noexcept {
+                    }
+
+                private:
+                    Scheduler& scheduler;
+                    int64_t delayMs;
+                    Suspension suspension;
+            };
+
+            Scheduler(IMessageQueue& queue)
+            : queue(queue) {
+                this->queue.Register(this);
+            }
+
+            virtual ~Scheduler() {
+                this->queue.Unregister(this);
+
+                std::unique_lock<std::mutex> lock(this->suspendedMutex);
+                while (this->suspended) {
+                    /* destroying the frame frees the node, too */
+                    auto handle = this->suspended->handle;
+                    this->Unlink(*this->suspended);
+                    handle.destroy();
+                }
+            }
+
+            Scheduler(const Scheduler&) = delete;
+            Scheduler& operator=(const Scheduler&) = delete;
+
+            IMessageQueue& Queue() {
+                return this->queue;
+            }
+
+            /* co_await scheduler.Delay(ms): resume after at least `ms` */
+            Awaitable Delay(int64_t delayMs) {
+                return Awaitable(*this, delayMs);
+            }
+
+            /* co_await scheduler.Yield(): let queued messages run first */
+            Awaitable Yield() {
+                return Awaitable(*this, 0);
+            }
+
+            virtual void ProcessMessage(IMessage& message) override {
+                if (message.Type() == MessageResume) {
+                    auto suspension = reinterpret_cast<Suspension*>((intptr_t) message.UserData1());
+                    std::coroutine_handle<> handle;
+                    {
+                        std::unique_lock<std::mutex> lock(this->suspendedMutex);
+                        handle = suspension->handle;
+                        this->Unlink(*suspension);
+                    }
+                    handle.resume();
+                }
+            }
+
+        private:
+            static const int MessageResume = 0;
+
+            void Suspend(Suspension& suspension, int64_t delayMs) {
+                {
+                    std::unique_lock<std::mutex> lock(this->suspendedMutex);
+                    suspension.prev = nullptr;
+                    suspension.next = this->suspended;
+                    if (this->suspended) {
+                        this->suspended->prev = &suspension;
+                    }
+                    this->suspended = &suspension;
+                }
+                this->queue.Post(Message::Create(
+                    this, MessageResume, (int64_t) reinterpret_cast<intptr_t>(&suspension)), delayMs);
+            }
+
+            /* expects suspendedMutex to be held */
+            void Unlink(Suspension& suspension) {
+                if (suspension.prev) {
+                    suspension.prev->next = suspension.next;
+                }
+                else {
+                    this->suspended = suspension.next;
+                }
+                if (suspension.next) {
+                    suspension.next->prev = suspension.prev;
+                }
+                suspension.prev = suspension.next = nullptr;
+            }
+
+            IMessageQueue& queue;
+            std::mutex suspendedMutex;
+            Suspension* suspended { nullptr }; /* intrusive list head */
+    };
+
+    /* co_await SwitchTo(scheduler): continue on the scheduler's queue */
+    inline Scheduler::Awaitable SwitchTo(Scheduler& scheduler) {
+        return scheduler.Yield();
+    }
+
+    /* a fire-and-forget coroutine. it starts running immediately, in the
+    caller, up to its first co_await, and its frame is released when it
+    finishes. exceptions escaping the coroutine terminate the process,
+    just like an exception escaping ProcessMessage() would. */
+    class Task {
+        public:
+            struct promise_type {
+                Task get_return_object() noexcept {
+                    return Task();
+                }
+
+                std::suspend_never initial_suspend() noexcept {
+                    return { };
+                }
+
+                std::suspend_never final_suspend() noexcept {
+                    return { };
+                }
+
+                void return_void() noexcept {
+                }
+
+                void unhandled_exception() noexcept {
+                    std::terminate();
+                }
+
+                static void* operator new(size_t size) {
+                    return CoroutineFrame::Allocate(size);
+                }
+
+                static void operator delete(void* frame, size_t size) {
+                    CoroutineFrame::Deallocate(frame, size);
+                }
+            };
+    };
+
+} }
+
+#endif
@@ -0,0 +1,278 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/EpollMessageQueue.h>
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+
+using namespace std::chrono;
+using namespace f8n::runtime;
+
+using LockT = std::unique_lock<std::mutex>;
+using TimePoint = steady_clock::time_point;
+
+static const int MAX_EVENTS = 64;
+
+static bool addFd(int epollFd, int fd, uint32_t events) {
+    epoll_event event = { };
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+EpollMessageQueue::EpollMessageQueue(TimerQueue::Type timerQueueType, IClockPtr clock)
+: MessageQueue(timerQueueType, clock)
+, signalFd(-1)
+, dispatching(false)
+, armed(TimePoint::max()) {
+    this->running.store(false);
+    this->quit.store(false);
+    this->wakePending.store(false);
+
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    this->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    this->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (this->epollFd < 0 || this->eventFd < 0 || this->timerFd < 0 ||
+        !addFd(this->epollFd, this->eventFd, EPOLLIN) ||
+        !addFd(this->epollFd, this->timerFd, EPOLLIN))
+    {
+        throw std::runtime_error("couldn't initialize the epoll event loop");
+    }
+}
+
+EpollMessageQueue::~EpollMessageQueue() {
+    for (int fd : { this->signalFd, this->timerFd, this->eventFd, this->epollFd }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void EpollMessageQueue::Run() {
+    this->loopThread = std::this_thread::get_id();
+    this->quit.store(false);
+    this->running.store(true);
+
+    /* pick up anything posted before the loop started */
+    this->Process();
+
+    epoll_event events[MAX_EVENTS];
+
+    while (!this->quit.load()) {
+        int count = epoll_wait(this->epollFd, events, MAX_EVENTS, -1);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait() failed");
+        }
+
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].data.fd;
+
+            if (fd == this->eventFd) {
+                /* clear the flag first; a post that races with this read
+                will write again, at worst causing a spurious wakeup. */
+                this->wakePending.store(false);
+                uint64_t value;
+                while (read(this->eventFd, &value, sizeof(value)) > 0) { }
+            }
+            else if (fd == this->timerFd) {
+                uint64_t expirations;
+                while (read(this->timerFd, &expirations, sizeof(expirations)) > 0) { }
+                this->armed = TimePoint::max();
+            }
+            else if (fd == this->signalFd) {
+                this->ReadSignals();
+            }
+            else {
+                std::shared_ptr<FdCallback> callback;
+                {
+                    LockT lock(this->watchersMutex);
+                    auto it = this->watchers.find(fd);
+                    if (it != this->watchers.end()) {
+                        callback = it->second;
+                    }
+                }
+                if (callback) {
+                    (*callback)(fd, events[i].events);
+                }
+            }
+        }
+
+        /* Dispatch() short-circuits if nothing is due */
+        this->Process();
+    }
+
+    this->running.store(false);
+}
+
+void EpollMessageQueue::Quit() {
+    this->quit.store(true);
+    this->Wake();
+}
+
+bool EpollMessageQueue::WatchFd(int fd, uint32_t events, FdCallback callback) {
+    LockT lock(this->watchersMutex);
+    if (this->watchers.find(fd) != this->watchers.end()) {
+        return false;
+    }
+    if (!addFd(this->epollFd, fd, events)) {
+        return false;
+    }
+    this->watchers[fd] = std::make_shared<FdCallback>(callback);
+    return true;
+}
+
+bool EpollMessageQueue::ModifyFd(int fd, uint32_t events) {
+    LockT lock(this->watchersMutex);
+    if (this->watchers.find(fd) == this->watchers.end()) {
+        return false;
+    }
+    epoll_event event = { };
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(this->epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void EpollMessageQueue::UnwatchFd(int fd) {
+    LockT lock(this->watchersMutex);
+    if (this->watchers.erase(fd)) {
+        epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+bool EpollMessageQueue::WatchSignals(const std::vector<int>& signals, SignalCallback callback) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signal : signals) {
+        sigaddset(&mask, signal);
+    }
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+        return false;
+    }
+
+    /* passing the existing fd replaces its mask */
+    int fd = signalfd(this->signalFd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (this->signalFd < 0) {
+        if (!addFd(this->epollFd, fd, EPOLLIN)) {
+            close(fd);
+            return false;
+        }
+        this->signalFd = fd;
+    }
+
+    this->signalCallback = callback;
+    return true;
+}
+
+void EpollMessageQueue::ReadSignals() {
+    signalfd_siginfo info;
+    while (read(this->signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (this->signalCallback) {
+            this->signalCallback((int) info.ssi_signo);
+        }
+    }
+}
+
+void EpollMessageQueue::OnDispatchTimeChanged() {
+    /* handlers we're dispatching right now are covered by the Rearm()
+    that follows; everyone else needs to wake the loop. */
+    if (!this->running.load()) {
+        return;
+    }
+    if (std::this_thread::get_id() == this->loopThread && this->dispatching) {
+        return;
+    }
+    this->Wake();
+}
+
+void EpollMessageQueue::Wake() {
+    if (!this->wakePending.exchange(true)) {
+        const uint64_t one = 1;
+        if (write(this->eventFd, &one, sizeof(one)) < 0) {
+            /* EAGAIN means the counter is saturated, so the loop is
+            already going to wake up. */
+        }
+    }
+}
+
+void EpollMessageQueue::Process() {
+    this->dispatching = true;
+    this->Dispatch();
+    this->dispatching = false;
+    this->Rearm();
+}
+
+void EpollMessageQueue::Rearm() {
+    const TimePoint next = this->GetNextMessageTime();
+
+    if (next == this->armed) {
+        return;
+    }
+
+    itimerspec spec = { };
+
+    if (next != TimePoint::max()) {
+        /* the queue's clock may not be CLOCK_MONOTONIC, so arm relative to
+        it. a zero it_value would disarm the timer; use 1ns for "now". */
+        const int64_t delay = std::max((int64_t) 1,
+            (int64_t) duration_cast<nanoseconds>(next - this->GetClock()->Now()).count());
+        spec.it_value.tv_sec = (time_t) (delay / 1000000000);
+        spec.it_value.tv_nsec = (long) (delay % 1000000000);
+    }
+
+    timerfd_settime(this->timerFd, 0, &spec, nullptr);
+    this->armed = next;
+}
+
+#endif
@@ -0,0 +1,109 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifdef __linux__
+
+#include <f8n/runtime/MessageQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace f8n { namespace runtime {
+
+    /* a MessageQueue that runs its own event loop on Linux primitives:
+    epoll for readiness, an eventfd for cross-thread wakeups (coalesced,
+    so a burst of posts costs one write), a timerfd re-armed to the next
+    message deadline, and an optional signalfd. arbitrary file
+    descriptors (sockets, pipes, ...) can be added to the same loop, so
+    I/O and messages are handled on one thread without a second poller. */
+    class EpollMessageQueue : public MessageQueue {
+        public:
+            using FdCallback = std::function<void(int fd, uint32_t events)>;
+            using SignalCallback = std::function<void(int signal)>;
+
+            EpollMessageQueue(
+                TimerQueue::Type timerQueueType = TimerQueue::Type::Heap,
+                IClockPtr clock = IClockPtr());
+
+            virtual ~EpollMessageQueue();
+
+            /* runs the loop on the calling thread until Quit() */
+            void Run();
+
+            /* may be called from any thread, including from a handler */
+            void Quit();
+
+            /* `events` is a mask of EPOLL* flags. callbacks run on the
+            loop thread, and may watch or unwatch fds (including their
+            own). the fd is not owned. */
+            bool WatchFd(int fd, uint32_t events, FdCallback callback);
+            bool ModifyFd(int fd, uint32_t events);
+            void UnwatchFd(int fd);
+
+            /* blocks `signals` in the calling thread and delivers them to
+            `callback` on the loop thread instead. call this before
+            starting any other threads, so they inherit the mask. */
+            bool WatchSignals(const std::vector<int>& signals, SignalCallback callback);
+
+        protected:
+            virtual void OnDispatchTimeChanged() override;
+
+        private:
+            void Process();
+            void Rearm();
+            void Wake();
+            void ReadSignals();
+
+            int epollFd, eventFd, timerFd, signalFd;
+            std::atomic<bool> running, quit, wakePending;
+            std::thread::id loopThread;
+            bool dispatching; /* only touched on the loop thread */
+            std::chrono::steady_clock::time_point armed; /* ditto */
+            SignalCallback signalCallback;
+            std::mutex watchersMutex;
+            std::unordered_map<int, std::shared_ptr<FdCallback>> watchers;
+    };
+
+} }
+
+#endif
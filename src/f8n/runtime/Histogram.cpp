@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/Histogram.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace f8n::runtime;
+
+static inline int highestBit(uint64_t value) {
+    int result = 0;
+    for (int shift = 32; shift > 0; shift >>= 1) {
+        if (value >> shift) {
+            value >>= shift;
+            result += shift;
+        }
+    }
+    return result;
+}
+
+Histogram::Histogram() {
+    this->Reset();
+}
+
+void Histogram::Reset() {
+    std::memset(this->buckets, 0, sizeof(this->buckets));
+    this->count = 0;
+    this->min = INT64_MAX;
+    this->max = 0;
+    this->sum = 0.0;
+}
+
+int Histogram::IndexOf(int64_t value) {
+    if (value < SubBucketCount) {
+        return (int) std::max((int64_t) 0, value);
+    }
+    const int msb = highestBit((uint64_t) value);
+    const int sub = (int) ((value >> (msb - SubBucketBits)) & (SubBucketCount - 1));
+    return (msb - SubBucketBits + 1) * SubBucketCount + sub;
+}
+
+int64_t Histogram::ValueAt(int index) {
+    if (index < SubBucketCount) {
+        return index;
+    }
+    const int msb = (index / SubBucketCount) + SubBucketBits - 1;
+    const int64_t sub = index % SubBucketCount;
+    return (SubBucketCount + sub) << (msb - SubBucketBits);
+}
+
+void Histogram::Record(int64_t value) {
+    value = std::max((int64_t) 0, value);
+    ++this->buckets[IndexOf(value)];
+    ++this->count;
+    this->min = std::min(this->min, value);
+    this->max = std::max(this->max, value);
+    this->sum += (double) value;
+}
+
+double Histogram::Mean() const {
+    return this->count ? this->sum / (double) this->count : 0.0;
+}
+
+int64_t Histogram::Percentile(double percentile) const {
+    if (this->count == 0) {
+        return 0;
+    }
+
+    percentile = std::min(100.0, std::max(0.0, percentile));
+    uint64_t threshold = (uint64_t) std::ceil((percentile / 100.0) * (double) this->count);
+    threshold = std::max((uint64_t) 1, threshold);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += this->buckets[i];
+        if (seen >= threshold) {
+            return std::max(this->min, std::min(ValueAt(i), this->max));
+        }
+    }
+
+    return this->max;
+}
+
+nlohmann::json Histogram::ToJson() const {
+    return {
+        { "count", this->Count() },
+        { "min", this->Min() },
+        { "max", this->Max() },
+        { "mean", this->Mean() },
+        { "p50", this->Percentile(50.0) },
+        { "p90", this->Percentile(90.0) },
+        { "p99", this->Percentile(99.0) },
+        { "p999", this->Percentile(99.9) }
+    };
+}
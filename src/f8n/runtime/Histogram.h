@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <json.hpp>
+
+#include <cstdint>
+
+namespace f8n { namespace runtime {
+
+    /* a fixed-size, log-linear histogram in the spirit of HdrHistogram.
+    each power of two is split into 16 linear sub-buckets, so recorded
+    values are accurate to within ~6%. Record() is a handful of integer
+    ops and never allocates. not thread safe; callers synchronize. */
+    class Histogram {
+        public:
+            Histogram();
+
+            void Record(int64_t value);
+            void Reset();
+
+            uint64_t Count() const { return this->count; }
+            int64_t Min() const { return this->count ? this->min : 0; }
+            int64_t Max() const { return this->max; }
+            double Mean() const;
+
+            /* percentile in the range [0, 100] */
+            int64_t Percentile(double percentile) const;
+
+            nlohmann::json ToJson() const;
+
+        private:
+            static const int SubBucketBits = 4;
+            static const int SubBucketCount = 1 << SubBucketBits;
+            static const int BucketCount = 64 * SubBucketCount;
+
+            static int IndexOf(int64_t value);
+            static int64_t ValueAt(int index);
+
+            uint64_t buckets[BucketCount];
+            uint64_t count;
+            int64_t min, max;
+            double sum;
+    };
+
+} }
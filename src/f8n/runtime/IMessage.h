@@ -40,6 +40,14 @@ namespace f8n { namespace runtime {
 
     class IMessageTarget;
 
+    /* among messages that are due at the same time, higher priorities are
+    dispatched first. */
+    enum class MessagePriority: int {
+        Low = 0, Normal = 1, High = 2
+    };
+
+    static const int MessagePriorityCount = 3;
+
     class IMessage {
         public:
             virtual ~IMessage() { }
@@ -47,6 +55,7 @@ namespace f8n { namespace runtime {
             virtual int Type() = 0;
             virtual int64_t UserData1() = 0;
             virtual int64_t UserData2() = 0;
+            virtual MessagePriority Priority() { return MessagePriority::Normal; }
     };
 
     typedef std::shared_ptr<IMessage> IMessagePtr;
@@ -37,11 +37,16 @@
 #include <f8n/runtime/IMessage.h>
 #include <f8n/runtime/IMessageTarget.h>
 
+#include <chrono>
+#include <vector>
+
 namespace f8n { namespace runtime {
     class IMessageQueue {
         public:
             virtual ~IMessageQueue() { }
             virtual void Post(IMessagePtr message, int64_t delayMs = 0) = 0;
+            virtual void PostBatch(std::vector<IMessagePtr>&& messages, int64_t delayMs = 0) = 0;
+            virtual void PostAt(IMessagePtr message, std::chrono::steady_clock::time_point deadline) = 0;
             virtual int Remove(IMessageTarget *target, int type = -1) = 0;
             virtual void Broadcast(IMessagePtr message, int64_t delayMs = 0) = 0;
             virtual bool Contains(IMessageTarget *target, int type = -1) = 0;
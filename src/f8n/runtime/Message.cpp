@@ -33,28 +33,49 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <f8n/runtime/Message.h>
+#include <f8n/runtime/Pool.h>
 
 using namespace f8n::runtime;
 
+namespace {
+    /* Message's constructor is protected; this gives allocate_shared
+    something it can construct. */
+    struct PooledMessage : public Message {
+        PooledMessage(
+            IMessageTarget* target,
+            int messageType,
+            int64_t data1,
+            int64_t data2,
+            MessagePriority priority)
+        : Message(target, messageType, data1, data2, priority) {
+        }
+    };
+}
+
 IMessagePtr Message::Create(
     IMessageTarget* target,
     int messageType,
     int64_t data1,
-    int64_t data2)
+    int64_t data2,
+    MessagePriority priority)
 {
-    return IMessagePtr(new Message(target, messageType, data1, data2));
+    /* one pooled allocation for both the message and its control block */
+    return std::allocate_shared<PooledMessage>(
+        PoolAllocator<PooledMessage>(), target, messageType, data1, data2, priority);
 }
 
 Message::Message(
     IMessageTarget* target,
     int messageType,
     int64_t data1,
-    int64_t data2)
+    int64_t data2,
+    MessagePriority priority)
 {
     this->target = target;
     this->messageType = messageType;
     this->data1 = data1;
     this->data2 = data2;
+    this->priority = priority;
 }
 
 IMessageTarget* Message::Target() {
@@ -71,4 +92,8 @@ int64_t Message::UserData1() {
 
 int64_t Message::UserData2() {
     return this->data2;
+}
+
+MessagePriority Message::Priority() {
+    return this->priority;
 }
\ No newline at end of file
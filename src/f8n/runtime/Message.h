@@ -43,14 +43,16 @@ namespace f8n { namespace runtime {
                 IMessageTarget* target,
                 int messageType,
                 int64_t data1,
-                int64_t data2);
+                int64_t data2,
+                MessagePriority priority = MessagePriority::Normal);
 
         public:
             static IMessagePtr Create(
                 IMessageTarget* target,
                 int messageType,
                 int64_t data1 = 0LL,
-                int64_t data2 = 0LL);
+                int64_t data2 = 0LL,
+                MessagePriority priority = MessagePriority::Normal);
 
             virtual ~Message() {
             }
@@ -59,10 +61,12 @@ namespace f8n { namespace runtime {
             virtual int Type();
             virtual int64_t UserData1();
             virtual int64_t UserData2();
+            virtual MessagePriority Priority();
 
         private:
             IMessageTarget* target;
             int messageType;
             int64_t data1, data2;
+            MessagePriority priority;
     };
 } }
\ No newline at end of file
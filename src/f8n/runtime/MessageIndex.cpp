@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/MessageIndex.h>
+
+using namespace f8n::runtime;
+
+void MessageIndex::Add(EnqueuedMessage* message) {
+    TargetEntry& entry = this->targets[message->target];
+    MessageIndexBucket& bucket = entry.types[message->type];
+    bucket.targetCount = &entry.count;
+
+    message->bucket = &bucket;
+    message->prev = bucket.tail;
+    message->next = nullptr;
+
+    if (bucket.tail) {
+        bucket.tail->next = message;
+    }
+    else {
+        bucket.head = message;
+    }
+
+    bucket.tail = message;
+    ++bucket.count;
+    ++entry.count;
+}
+
+void MessageIndex::Remove(EnqueuedMessage* message) {
+    MessageIndexBucket* bucket = message->bucket;
+
+    if (!bucket) {
+        return;
+    }
+
+    if (message->prev) {
+        message->prev->next = message->next;
+    }
+    else {
+        bucket->head = message->next;
+    }
+
+    if (message->next) {
+        message->next->prev = message->prev;
+    }
+    else {
+        bucket->tail = message->prev;
+    }
+
+    --bucket->count;
+    --(*bucket->targetCount);
+
+    message->bucket = nullptr;
+    message->prev = message->next = nullptr;
+}
+
+bool MessageIndex::Contains(IMessageTarget* target, int type) {
+    auto it = this->targets.find(target);
+    if (it == this->targets.end()) {
+        return false;
+    }
+    if (type == -1) {
+        return it->second.count > 0;
+    }
+    auto bucket = it->second.types.find(type);
+    return bucket != it->second.types.end() && bucket->second.count > 0;
+}
+
+void MessageIndex::Find(IMessageTarget* target, int type, std::vector<EnqueuedMessage*>& result) {
+    auto it = this->targets.find(target);
+    if (it == this->targets.end() || it->second.count == 0) {
+        return;
+    }
+
+    auto collect = [&result](MessageIndexBucket& bucket) {
+        for (EnqueuedMessage* m = bucket.head; m; m = m->next) {
+            result.push_back(m);
+        }
+    };
+
+    if (type == -1) {
+        for (auto& bucket : it->second.types) {
+            collect(bucket.second);
+        }
+    }
+    else {
+        auto bucket = it->second.types.find(type);
+        if (bucket != it->second.types.end()) {
+            collect(bucket->second);
+        }
+    }
+}
+
+size_t MessageIndex::Count(IMessageTarget* target) {
+    auto it = this->targets.find(target);
+    return it == this->targets.end() ? 0 : it->second.count;
+}
+
+EnqueuedMessage* MessageIndex::Oldest(IMessageTarget* target) {
+    auto it = this->targets.find(target);
+    if (it == this->targets.end() || it->second.count == 0) {
+        return nullptr;
+    }
+
+    /* buckets are in insertion order, so the oldest is one of the heads */
+    EnqueuedMessage* result = nullptr;
+    for (auto& bucket : it->second.types) {
+        EnqueuedMessage* head = bucket.second.head;
+        if (head && (!result || head->sequence < result->sequence)) {
+            result = head;
+        }
+    }
+    return result;
+}
+
+void MessageIndex::Drop(IMessageTarget* target) {
+    /* callers are expected to have removed the target's messages first */
+    this->targets.erase(target);
+}
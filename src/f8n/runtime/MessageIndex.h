@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/TimerQueue.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace f8n { namespace runtime {
+
+    struct MessageIndexBucket {
+        EnqueuedMessage* head { nullptr };
+        EnqueuedMessage* tail { nullptr };
+        size_t count { 0 };
+        size_t* targetCount { nullptr };
+    };
+
+    /* indexes pending messages by (target, type) so lookups and removals
+    don't need to scan the entire queue. each EnqueuedMessage is linked
+    into exactly one bucket, in insertion order. buckets are retained
+    after they drain so steady-state traffic doesn't churn the maps; they
+    are only released when the target is dropped. */
+    class MessageIndex {
+        public:
+            void Add(EnqueuedMessage* message);
+            void Remove(EnqueuedMessage* message);
+            bool Contains(IMessageTarget* target, int type = -1);
+            void Find(IMessageTarget* target, int type, std::vector<EnqueuedMessage*>& result);
+            size_t Count(IMessageTarget* target);
+            EnqueuedMessage* Oldest(IMessageTarget* target); /* by enqueue order */
+            void Drop(IMessageTarget* target);
+
+        private:
+            struct TargetEntry {
+                size_t count { 0 };
+                std::unordered_map<int, MessageIndexBucket> types;
+            };
+
+            std::unordered_map<IMessageTarget*, TargetEntry> targets;
+    };
+
+} }
@@ -33,39 +33,146 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/Histogram.h>
+#include <f8n/runtime/MessageTrace.h>
+#include <f8n/runtime/Clock.h>
+#include <f8n/debug/debug.h>
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <iterator>
+#include <unordered_map>
 
 using namespace std::chrono;
 using namespace f8n::runtime;
 
 using LockT = std::unique_lock<std::mutex>;
+using ReadLockT = std::shared_lock<std::shared_mutex>;
+using WriteLockT = std::unique_lock<std::shared_mutex>;
 
-MessageQueue::MessageQueue() {
+using TimePoint = steady_clock::time_point;
+
+/* the queue (if any) this thread is currently delivering messages for;
+producers on that thread must never block waiting for space. */
+static thread_local MessageQueue* dispatchingQueue = nullptr;
+
+namespace f8n { namespace runtime {
+    struct RepeatingTimer {
+        MessageQueue::RepeatingHandle handle;
+        steady_clock::duration period;
+        steady_clock::duration tolerance;
+        TimePoint ideal; /* the deadline before tolerance is applied */
+        bool inFlight; /* popped by Dispatch(), not yet rescheduled */
+        bool cancelled;
+    };
+} }
+
+static inline TimePoint applyTolerance(TimePoint time, steady_clock::duration tolerance) {
+    /* round up to the tolerance grid so timers sharing a tolerance also
+    share deadlines */
+    const auto ticks = time.time_since_epoch().count();
+    const auto grid = tolerance.count();
+    if (grid <= 0) {
+        return time;
+    }
+    return TimePoint(steady_clock::duration(((ticks + grid - 1) / grid) * grid));
+}
+
+struct MessageQueue::Instrumentation {
+    struct Key {
+        IMessageTarget* target;
+        int type;
+        bool operator==(const Key& other) const {
+            return target == other.target && type == other.type;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<IMessageTarget*>()(key.target) ^ (std::hash<int>()(key.type) * 31);
+        }
+    };
+
+    struct Entry {
+        uint64_t count { 0 };
+        Histogram latency;
+        Histogram processing;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    size_t depth { 0 };
+    size_t highWater { 0 };
+};
+
+struct MessageQueue::Monitor {
+    /* written by the dispatching thread, read by anyone. `started` is
+    written last (and cleared first), so a reader that sees the same
+    non-zero value before and after reading the rest saw a consistent
+    snapshot. */
+    std::atomic<int64_t> started { 0 }; /* steady_clock ticks; 0 if idle */
+    std::atomic<IMessageTarget*> target { nullptr };
+    std::atomic<int> type { 0 };
+    std::atomic<uint64_t> generation { 0 };
+
+    std::mutex mutex;
+    Histogram lag;
+};
+
+MessageQueue::MessageQueue(TimerQueue::Type timerQueueType, IClockPtr clock)
+: clock(clock ? clock : SteadyClock::Instance())
+, dispatchBudget(0) {
+    for (int i = 0; i < MessagePriorityCount; i++) {
+        this->lanes[i].reset(TimerQueue::Create(timerQueueType));
+        this->laneStats[i] = LaneStats { 0, 0, nanoseconds(0), nanoseconds(0) };
+    }
     this->nextMessageTime.store(1);
+    this->nextSequence.store(0);
+    this->intakeCount.store(0);
+    this->waiting.store(false);
+    this->instrumentation.store(nullptr);
+    this->monitor.store(nullptr);
+    this->trace.store(nullptr);
+    this->bounded.store(false);
+    this->queueLimit = Limit { 0, OverflowPolicy::Block };
+    this->overflowStats = OverflowStats { 0, 0, 0, 0, 0 };
+    this->blockedProducers = 0;
+    this->nextRepeatingHandle = 1;
+    this->repeatingInFlight = 0;
+    this->receivers = std::make_shared<const ReceiverList>();
 }
 
 void MessageQueue::WaitAndDispatch(int64_t timeoutMillis) {
     {
         LockT lock(this->queueMutex);
 
-        if (this->queue.size()) {
-            auto waitTime = duration_cast<milliseconds>(
-                this->queue.front()->time -
-                system_clock::now().time_since_epoch());
+        this->DrainIntake();
+
+        /* producers posting through the intake only take the lock to wake
+        us if they see this flag; see WakeDispatcher() */
+        this->waiting.store(true);
+
+        if (this->intakeCount.load() > 0) {
+            /* something arrived since we drained; don't sleep. */
+        }
+        else if (EnqueuedMessage* earliest = this->Earliest()) {
+            /* sleep until the next deadline (or the timeout, whichever comes
+            first) without rounding to milliseconds. */
+            TimePoint wakeTime = earliest->time;
 
             if (timeoutMillis >= 0) {
-                auto timeoutDuration = milliseconds(timeoutMillis);
-                if (waitTime > timeoutDuration) {
-                    waitTime = timeoutDuration;
-                }
+                wakeTime = std::min(wakeTime, this->FromNow(timeoutMillis));
             }
 
-            if (waitTime.count() > 0) {
-                waitForDispatch.wait_for(lock, waitTime);
+            /* wakeTime is on the queue's clock, which may not be the
+            one the condition variable waits on; wait for the difference. */
+            const TimePoint current = this->Now();
+            if (wakeTime > current) {
+                waitForDispatch.wait_for(lock, wakeTime - current);
             }
-       }
+        }
         else {
             if (timeoutMillis >= 0) {
                 waitForDispatch.wait_for(lock, milliseconds(timeoutMillis));
@@ -74,239 +181,986 @@ void MessageQueue::WaitAndDispatch(int64_t timeoutMillis) {
                 waitForDispatch.wait(lock);
             }
         }
+
+        this->waiting.store(false);
     }
 
     this->Dispatch();
 }
 
 MessageQueue::~MessageQueue() {
-
+    this->DrainIntake();
+    for (auto& lane : this->lanes) {
+        while (EnqueuedMessage* m = lane->Top()) {
+            this->Erase(m);
+            this->Release(m);
+        }
+    }
 }
 
 void MessageQueue::Dispatch() {
-    milliseconds now = duration_cast<milliseconds>(
-        system_clock::now().time_since_epoch());
+    TimePoint now = this->Now();
 
     int64_t nextTime = nextMessageTime.load();
 
-    if (nextTime > now.count() || nextTime < 0) {
+    if (this->intakeCount.load() == 0 && (nextTime > now.time_since_epoch().count() || nextTime < 0)) {
         return; /* short circuit before any iteration. */
     }
 
-    using Iterator = std::list<EnqueuedMessage*>::iterator;
+    Instrumentation* instrumentation =
+        this->instrumentation.load(std::memory_order_relaxed);
+
+    MessageTrace* trace = this->trace.load(std::memory_order_relaxed);
+
+    Monitor* monitor = this->monitor.load(std::memory_order_relaxed);
+    nanoseconds lag(0);
 
     {
         LockT lock(this->queueMutex);
 
-        this->nextMessageTime.store(-1);
+        this->DrainIntake();
+
+        if (instrumentation) {
+            /* messages only ever leave the queue here (or via Remove), so
+            sampling right before we pop catches the high-water mark. */
+            size_t depth = 0;
+            for (auto& lane : this->lanes) {
+                depth += lane->Size();
+            }
+            std::unique_lock<std::mutex> statsLock(instrumentation->mutex);
+            instrumentation->depth = depth;
+            instrumentation->highWater = std::max(instrumentation->highWater, depth);
+        }
+
+        /* each lane is time-ordered. starting with the highest priority
+        lane, pop messages until we get to one that should be delivered in
+        the future, the lane has been exhausted, or we're over budget. */
+        size_t budget = this->dispatchBudget ? this->dispatchBudget : SIZE_MAX;
+        for (int i = MessagePriorityCount - 1; i >= 0 && budget > 0; i--) {
+            TimerQueue& lane = *this->lanes[i];
+            LaneStats& stats = this->laneStats[i];
+            EnqueuedMessage *m = lane.Top();
+            while (m && now >= m->time && budget > 0) {
+                this->Erase(m);
+                this->dispatch.push_back(m);
+
+                if (m->repeating) {
+                    m->repeating->inFlight = true;
+                    ++this->repeatingInFlight;
+                }
 
-        Iterator it = this->queue.begin();
+                const nanoseconds wait = duration_cast<nanoseconds>(now - m->time);
+                ++stats.dispatched;
+                stats.totalWait += wait;
+                stats.maxWait = std::max(stats.maxWait, wait);
+                lag = std::max(lag, wait);
 
-        bool done = false;
-        while (!done && it != this->queue.end()) {
-            /* messages are time-ordered. pop and dispatch one at a time
-            until we get to a message that should be delivered in the future,
-            or the queue has been exhausted. */
+                --budget;
+                m = lane.Top();
+            }
+        }
 
-            EnqueuedMessage *m = (*it);
+        this->UpdateNextMessageTime();
 
-            if (now >= m->time) {
-                /* it's possible the target (receiver) has been unregistered;
-                if that's the case, just discard it. otherwise, add it to the
-                output set to be dispatched outside of the critical section */
-                auto const target = (*it)->message->Target();
-                if (target == nullptr || this->targets.find(target) != this->targets.end()) {
-                    this->dispatch.push_back(m);
+        if (this->blockedProducers && !this->dispatch.empty()) {
+            this->spaceAvailable.notify_all();
+        }
+    }
+
+    if (this->dispatch.empty()) {
+        return;
+    }
+
+    if (monitor) {
+        std::unique_lock<std::mutex> lock(monitor->mutex);
+        monitor->lag.Record(lag.count());
+    }
+
+    {
+        /* it's possible the target (receiver) has been unregistered;
+        if that's the case, just discard it. otherwise, keep it in the
+        output set to be dispatched outside of the critical section */
+        ReadLockT lock(this->registryMutex);
+        auto end = std::remove_if(
+            this->dispatch.begin(),
+            this->dispatch.end(),
+            [this](EnqueuedMessage* m) {
+                if (m->target && this->targets.find(m->target) == this->targets.end()) {
+                    if (m->repeating) {
+                        this->reschedule.push_back(m); /* released there */
+                    }
+                    else {
+                        delete m;
+                    }
+                    return true;
                 }
-                it = this->queue.erase(it);
+                return false;
+            });
+        this->dispatch.erase(end, this->dispatch.end());
+    }
+
+    if (trace) {
+        for (auto m : this->dispatch) {
+            trace->Add(MessageTrace::Make(
+                MessageTrace::Event::Dispatch, now, m->time, *m->message));
+        }
+    }
+
+    /* dispatch outside of the critical section */
+
+    MessageQueue* previous = dispatchingQueue;
+    dispatchingQueue = this;
+
+    if (instrumentation || monitor) {
+        this->DispatchInstrumented(instrumentation, monitor);
+    }
+    else {
+        for (auto m : this->dispatch) {
+            this->Dispatch(m->message);
+            if (m->repeating) {
+                this->reschedule.push_back(m);
             }
             else {
-                done = true;
+                delete m;
             }
         }
     }
 
-    /* dispatch outside of the critical section */
+    dispatchingQueue = previous;
+
+    this->dispatch.clear();
 
-    Iterator it = this->dispatch.begin();
-    while (it != this->dispatch.end()) {
-        this->Dispatch((*it)->message);
-        delete *it;
-        it++;
+    if (!this->reschedule.empty()) {
+        this->Reschedule();
     }
+}
 
-    this->dispatch.clear();
+void MessageQueue::Reschedule() {
+    LockT lock(this->queueMutex);
+
+    const TimePoint now = this->Now();
+    EnqueuedMessage* top = this->Earliest();
+    MessageTrace* trace = this->trace.load(std::memory_order_relaxed);
+
+    for (auto m : this->reschedule) {
+        RepeatingTimer& timer = *m->repeating;
+
+        timer.inFlight = false;
+        --this->repeatingInFlight;
+
+        if (timer.cancelled) {
+            this->Release(m);
+            continue;
+        }
+
+        /* advance from the ideal deadline, skipping any we've missed */
+        timer.ideal += timer.period;
+        if (timer.ideal < now) {
+            const auto missed = (now - timer.ideal + timer.period - steady_clock::duration(1)) / timer.period;
+            timer.ideal += timer.period * missed;
+        }
+
+        m->time = applyTolerance(timer.ideal, timer.tolerance);
+        m->sequence = this->nextSequence.fetch_add(1);
+        if (this->instrumentation.load(std::memory_order_relaxed)) {
+            m->enqueued = now;
+        }
+        if (trace) {
+            trace->Add(MessageTrace::Make(
+                MessageTrace::Event::Post, now, m->time, *m->message));
+        }
 
-    if (this->queue.size()) {
-        this->nextMessageTime.store((*this->queue.begin())->time.count());
+        this->Insert(m);
+    }
+
+    this->reschedule.clear();
+
+    this->UpdateNextMessageTime();
+
+    if (this->Earliest() != top) {
+        this->waitForDispatch.notify_all();
+        this->OnDispatchTimeChanged();
     }
 }
 
-void MessageQueue::Register(IMessageTarget* target) {
+MessageQueue::RepeatingHandle MessageQueue::ScheduleRepeating(
+    IMessageTarget* target, int type, int64_t periodMs, int64_t toleranceMs)
+{
+    return this->ScheduleRepeating(Message::Create(target, type), periodMs, toleranceMs);
+}
+
+MessageQueue::RepeatingHandle MessageQueue::ScheduleRepeating(
+    IMessagePtr message, int64_t periodMs, int64_t toleranceMs)
+{
+    if (periodMs <= 0) {
+        return 0;
+    }
+
+    ReadLockT registryLock(this->registryMutex);
+
+    if (this->targets.find(message->Target()) == this->targets.end()) {
+        return 0;
+    }
+
     LockT lock(this->queueMutex);
-    this->targets.insert(target);
+
+    const TimePoint ideal = this->FromNow(periodMs);
+    const auto tolerance = duration_cast<steady_clock::duration>(
+        milliseconds(std::max((int64_t) 0, toleranceMs)));
+
+    EnqueuedMessage* m = this->CreateEntry(
+        std::move(message), applyTolerance(ideal, tolerance));
+
+    m->repeating = new RepeatingTimer {
+        this->nextRepeatingHandle++,
+        duration_cast<steady_clock::duration>(milliseconds(periodMs)),
+        tolerance,
+        ideal,
+        false,
+        false
+    };
+
+    this->repeating[m->repeating->handle] = m;
+
+    this->Insert(m);
+
+    bool first = (this->Earliest() == m);
+
+    this->UpdateNextMessageTime();
+
+    if (first) {
+        this->waitForDispatch.notify_all();
+        this->OnDispatchTimeChanged();
+    }
+
+    return m->repeating->handle;
 }
 
-void MessageQueue::Unregister(IMessageTarget* target) {
-    bool shouldRemove = false;
+bool MessageQueue::CancelRepeating(RepeatingHandle handle) {
+    LockT lock(this->queueMutex);
+
+    auto it = this->repeating.find(handle);
+    if (it == this->repeating.end()) {
+        return false;
+    }
+
+    EnqueuedMessage* m = it->second;
+
+    if (m->repeating->inFlight) {
+        /* being delivered right now; Reschedule() will release it */
+        m->repeating->cancelled = true;
+        this->repeating.erase(it);
+    }
+    else {
+        this->Erase(m);
+        this->Release(m);
+        this->UpdateNextMessageTime();
+    }
+
+    return true;
+}
+
+void MessageQueue::Release(EnqueuedMessage* m) {
+    /* callers must hold queueMutex */
+    if (m->repeating) {
+        this->repeating.erase(m->repeating->handle);
+        delete m->repeating;
+    }
+    delete m;
+}
+
+void MessageQueue::DispatchInstrumented(Instrumentation* instrumentation, Monitor* monitor) {
+    for (auto m : this->dispatch) {
+        const TimePoint start = this->Now();
+        const auto processingStart = steady_clock::now();
+
+        if (monitor) {
+            monitor->started.store(0);
+            monitor->target.store(m->target);
+            monitor->type.store(m->type);
+            monitor->generation.fetch_add(1);
+            monitor->started.store(processingStart.time_since_epoch().count());
+        }
+
+        this->Dispatch(m->message);
+
+        if (monitor) {
+            monitor->started.store(0);
+        }
+
+        const auto processingEnd = steady_clock::now();
+
+        if (instrumentation) {
+            std::unique_lock<std::mutex> lock(instrumentation->mutex);
+            auto& entry = instrumentation->entries[{ m->target, m->type }];
+            ++entry.count;
+            if (m->enqueued != TimePoint()) {
+                entry.latency.Record(duration_cast<nanoseconds>(start - m->enqueued).count());
+            }
+            entry.processing.Record(duration_cast<nanoseconds>(processingEnd - processingStart).count());
+        }
+
+        if (m->repeating) {
+            this->reschedule.push_back(m);
+        }
+        else {
+            delete m;
+        }
+    }
+}
+
+void MessageQueue::EnableInstrumentation(bool enabled) {
+    LockT lock(this->queueMutex);
+    if (enabled) {
+        if (!this->instrumentationData) {
+            this->instrumentationData.reset(new Instrumentation());
+        }
+        this->instrumentation.store(this->instrumentationData.get());
+    }
+    else {
+        /* the data is kept around (and reported) until the queue is
+        destroyed; a dispatch may still be writing to it. */
+        this->instrumentation.store(nullptr);
+    }
+}
+
+void MessageQueue::EnableMonitoring(bool enabled) {
+    LockT lock(this->queueMutex);
+    if (enabled) {
+        if (!this->monitorData) {
+            this->monitorData.reset(new Monitor());
+        }
+        this->monitor.store(this->monitorData.get());
+    }
+    else {
+        /* kept alive until the queue is destroyed; see EnableInstrumentation() */
+        this->monitor.store(nullptr);
+    }
+}
+
+MessageQueue::HandlerState MessageQueue::GetHandlerState() {
+    HandlerState state = { false, nullptr, 0, 0, nanoseconds(0) };
+
+    Monitor* monitor = this->monitor.load();
+    if (!monitor) {
+        return state;
+    }
+
+    const int64_t started = monitor->started.load();
+    if (started) {
+        state.target = monitor->target.load();
+        state.type = monitor->type.load();
+        state.generation = monitor->generation.load();
+        if (monitor->started.load() == started) {
+            const auto startTime = steady_clock::time_point(steady_clock::duration(started));
+            state.busy = true;
+            state.elapsed = duration_cast<nanoseconds>(steady_clock::now() - startTime);
+        }
+    }
+
+    return state;
+}
+
+Histogram MessageQueue::GetLoopLag() {
+    Monitor* monitor = this->monitor.load();
+    if (!monitor) {
+        return Histogram();
+    }
+    std::unique_lock<std::mutex> lock(monitor->mutex);
+    return monitor->lag;
+}
+
+nlohmann::json MessageQueue::GetStats() {
+    nlohmann::json result;
+
+    nlohmann::json lanes = nlohmann::json::array();
+    for (int i = 0; i < MessagePriorityCount; i++) {
+        LaneStats stats = this->GetLaneStats((MessagePriority) i);
+        lanes.push_back({
+            { "priority", i },
+            { "depth", stats.depth },
+            { "dispatched", stats.dispatched },
+            { "totalWaitNs", stats.totalWait.count() },
+            { "maxWaitNs", stats.maxWait.count() }
+        });
+    }
+    result["lanes"] = lanes;
+
+    OverflowStats overflow = this->GetOverflowStats();
+    result["overflow"] = {
+        { "blocked", overflow.blocked },
+        { "droppedOldest", overflow.droppedOldest },
+        { "droppedNewest", overflow.droppedNewest },
+        { "coalesced", overflow.coalesced },
+        { "overCapacity", overflow.overCapacity }
+    };
+
+    Instrumentation* instrumentation = nullptr;
     {
         LockT lock(this->queueMutex);
-        if (this->targets.find(target) != this->targets.end()) {
-            this->targets.erase(target);
-            shouldRemove = true;
+        instrumentation = this->instrumentationData.get();
+    }
+
+    result["instrumented"] = this->instrumentation.load() != nullptr;
+
+    if (instrumentation) {
+        std::unique_lock<std::mutex> lock(instrumentation->mutex);
+        result["depth"] = instrumentation->depth;
+        result["highWater"] = instrumentation->highWater;
+
+        nlohmann::json messages = nlohmann::json::array();
+        for (auto& it : instrumentation->entries) {
+            char target[32];
+            snprintf(target, sizeof(target), "%p", (void*) it.first.target);
+            messages.push_back({
+                { "target", target },
+                { "type", it.first.type },
+                { "count", it.second.count },
+                { "latencyNs", it.second.latency.ToJson() },
+                { "processingNs", it.second.processing.ToJson() }
+            });
         }
+        result["messages"] = messages;
     }
-    if (shouldRemove) {
-        this->Remove(target);
+
+    return result;
+}
+
+void MessageQueue::DumpStats(const std::string& tag) {
+    f8n::debug::info(tag, this->GetStats().dump());
+}
+
+EnqueuedMessage* MessageQueue::Earliest() {
+    EnqueuedMessage* result = nullptr;
+    for (auto& lane : this->lanes) {
+        EnqueuedMessage* top = lane->Top();
+        if (top && (!result || TimerQueue::Earlier(top, result))) {
+            result = top;
+        }
     }
+    return result;
 }
 
-void MessageQueue::RegisterForBroadcasts(IMessageTargetPtr target) {
+void MessageQueue::Insert(EnqueuedMessage* m) {
+    this->lanes[m->lane]->Push(m);
+    this->index.Add(m);
+}
+
+void MessageQueue::Erase(EnqueuedMessage* m) {
+    this->index.Remove(m);
+    this->lanes[m->lane]->Erase(m);
+}
+
+MessageQueue::LaneStats MessageQueue::GetLaneStats(MessagePriority priority) {
     LockT lock(this->queueMutex);
-    this->receivers.insert(target);
+    this->DrainIntake();
+    LaneStats stats = this->laneStats[(int) priority];
+    stats.depth = this->lanes[(int) priority]->Size();
+    return stats;
 }
 
-void MessageQueue::UnregisterForBroadcasts(IMessageTarget *target) {
+void MessageQueue::SetDispatchBudget(size_t budget) {
     LockT lock(this->queueMutex);
-    for (auto it : this->receivers) {
-        auto shared = it.lock();
-        if (shared && shared.get() == target) {
-            this->receivers.erase(it);
+    this->dispatchBudget = budget;
+}
+
+void MessageQueue::UpdateNextMessageTime() {
+    EnqueuedMessage* top = this->Earliest();
+    this->nextMessageTime.store(top ? top->time.time_since_epoch().count() : -1);
+}
+
+TimePoint MessageQueue::GetNextMessageTime() {
+    if (this->intakeCount.load() > 0) {
+        return this->Now();
+    }
+    const int64_t next = this->nextMessageTime.load();
+    return next < 0 ? TimePoint::max() : TimePoint(TimePoint::duration(next));
+}
+
+void MessageQueue::Register(IMessageTarget* target) {
+    WriteLockT lock(this->registryMutex);
+    this->targets.insert(target);
+}
+
+void MessageQueue::Unregister(IMessageTarget* target) {
+    /* holding the registry lock exclusively guarantees no Post() is midway
+    through pushing a message for this target onto the intake. */
+    WriteLockT registryLock(this->registryMutex);
+    if (this->targets.erase(target)) {
+        LockT lock(this->queueMutex);
+        this->RemoveLocked(target, -1);
+        this->index.Drop(target);
+        if (this->targetLimits.erase(target)) {
+            this->UpdateBounded();
+        }
+        /* producers blocked on this target give up once they see it's gone */
+        if (this->blockedProducers) {
+            this->spaceAvailable.notify_all();
+        }
+    }
+}
+
+void MessageQueue::RegisterForBroadcasts(IMessageTargetPtr target) {
+    LockT lock(this->receiversMutex);
+    auto updated = this->CopyLiveReceivers(nullptr);
+    for (auto& receiver : *updated) {
+        if (receiver.id == target.get()) {
             return;
         }
     }
+    updated->push_back({ target.get(), target });
+    std::atomic_store(&this->receivers, ReceiverListPtr(updated));
+}
+
+void MessageQueue::UnregisterForBroadcasts(IMessageTarget *target) {
+    LockT lock(this->receiversMutex);
+    std::atomic_store(&this->receivers, ReceiverListPtr(this->CopyLiveReceivers(target)));
+}
+
+std::shared_ptr<MessageQueue::ReceiverList> MessageQueue::CopyLiveReceivers(IMessageTarget* exclude) {
+    /* callers must hold receiversMutex. expired receivers are dropped from
+    every new snapshot, so a new receiver that happens to reuse a dead
+    one's address doesn't collide with it. */
+    auto current = std::atomic_load(&this->receivers);
+    auto result = std::make_shared<ReceiverList>();
+    result->reserve(current->size() + 1);
+    for (auto& receiver : *current) {
+        if (receiver.id != exclude && !receiver.target.expired()) {
+            result->push_back(receiver);
+        }
+    }
+    return result;
 }
 
 int MessageQueue::Remove(IMessageTarget *target, int type) {
     LockT lock(this->queueMutex);
+    return this->RemoveLocked(target, type);
+}
 
-    int count = 0;
-    std::list<EnqueuedMessage*>::iterator it = this->queue.begin();
-    while (it != this->queue.end()) {
-        IMessagePtr current = (*it)->message;
+int MessageQueue::RemoveLocked(IMessageTarget *target, int type) {
+    this->DrainIntake();
 
-        if (current->Target() == target) {
-            if (type == -1 || type == current->Type()) {
-                delete (*it);
-                it = this->queue.erase(it);
-                ++count;
-                continue;
+    this->matches.clear();
+    this->index.Find(target, type, this->matches);
+
+    for (auto m : this->matches) {
+        this->Erase(m);
+        this->Release(m);
+    }
+
+    /* repeating timers being delivered aren't in the index; make sure
+    they don't get rescheduled */
+    if (this->repeatingInFlight) {
+        for (auto it = this->repeating.begin(); it != this->repeating.end(); ) {
+            EnqueuedMessage* m = it->second;
+            if (m->repeating->inFlight && m->target == target && (type == -1 || m->type == type)) {
+                m->repeating->cancelled = true;
+                it = this->repeating.erase(it);
+            }
+            else {
+                ++it;
             }
         }
-
-        ++it;
     }
 
-    if (this->queue.size()) {
-        this->nextMessageTime.store((*this->queue.begin())->time.count());
+    if (this->matches.size()) {
+        this->UpdateNextMessageTime();
+        if (this->blockedProducers) {
+            this->spaceAvailable.notify_all();
+        }
     }
 
-    return count;
+    return (int) this->matches.size();
 }
 
 bool MessageQueue::Contains(IMessageTarget *target, int type) {
     LockT lock(this->queueMutex);
+    this->DrainIntake();
+    return this->index.Contains(target, type);
+}
 
-    std::list<EnqueuedMessage*>::iterator it = this->queue.begin();
-    while (it != this->queue.end()) {
-        IMessagePtr current = (*it)->message;
+void MessageQueue::Broadcast(IMessagePtr message, int64_t delayMs) {
+    if (message->Target()) {
+        throw new std::runtime_error("broadcasts cannot have a target!");
+    }
 
-        if (current->Target() == target) {
-            if (type == -1 || type == current->Type()) {
-                return true;
+    if (this->bounded.load(std::memory_order_relaxed)) {
+        this->PostBounded(std::move(message), this->FromNow(delayMs), false);
+    }
+    else if (delayMs <= 0) {
+        this->EnqueueLockFree(message);
+    }
+    else {
+        LockT lock(this->queueMutex);
+        this->Enqueue(message, delayMs);
+    }
+}
+
+void MessageQueue::Post(IMessagePtr message, int64_t delayMs) {
+    if (this->bounded.load(std::memory_order_relaxed) && message->Target()) {
+        this->PostBounded(std::move(message), this->FromNow(delayMs), false);
+        return;
+    }
+
+    ReadLockT registryLock(this->registryMutex);
+
+    if (this->targets.find(message->Target()) == this->targets.end()) {
+        return;
+    }
+
+    if (delayMs <= 0) {
+        this->EnqueueLockFree(message);
+    }
+    else {
+        LockT lock(this->queueMutex);
+        this->Enqueue(message, delayMs);
+    }
+}
+
+void MessageQueue::PostBatch(std::vector<IMessagePtr>&& messages, int64_t delayMs) {
+    const TimePoint time = this->FromNow(delayMs);
+
+    if (this->bounded.load(std::memory_order_relaxed)) {
+        /* each message is admitted (or not) individually */
+        for (auto& message : messages) {
+            if (message->Target()) {
+                this->PostBounded(std::move(message), time, false);
             }
         }
+        messages.clear();
+        return;
+    }
+
+    ReadLockT registryLock(this->registryMutex);
 
-        ++it;
+    if (delayMs <= 0) {
+        size_t count = 0;
+        for (auto& message : messages) {
+            if (this->targets.find(message->Target()) != this->targets.end()) {
+                this->PushIntake(this->CreateEntry(std::move(message), time));
+                ++count;
+            }
+        }
+        if (count) {
+            this->WakeDispatcher();
+        }
     }
-    return false;
-}
+    else {
+        LockT lock(this->queueMutex);
 
-void MessageQueue::Broadcast(IMessagePtr message, int64_t delayMs) {
-    LockT lock(this->queueMutex);
+        EnqueuedMessage* top = this->Earliest();
 
-    if (message->Target()) {
-        throw new std::runtime_error("broadcasts cannot have a target!");
+        for (auto& message : messages) {
+            if (this->targets.find(message->Target()) != this->targets.end()) {
+                this->Insert(this->CreateEntry(std::move(message), time));
+            }
+        }
+
+        this->UpdateNextMessageTime();
+
+        if (this->Earliest() != top) {
+            this->waitForDispatch.notify_all();
+            this->OnDispatchTimeChanged();
+        }
     }
 
-    this->Enqueue(message, delayMs);
+    messages.clear();
 }
 
-void MessageQueue::Post(IMessagePtr message, int64_t delayMs) {
-    LockT lock(this->queueMutex);
+void MessageQueue::PostAt(IMessagePtr message, TimePoint deadline) {
+    if (this->bounded.load(std::memory_order_relaxed) && message->Target()) {
+        this->PostBounded(std::move(message), deadline, false);
+        return;
+    }
+
+    ReadLockT registryLock(this->registryMutex);
 
     if (this->targets.find(message->Target()) == this->targets.end()) {
         return;
     }
 
-    this->Enqueue(message, delayMs);
+    LockT lock(this->queueMutex);
+    this->Enqueue(message, deadline);
 }
 
-void MessageQueue::Enqueue(IMessagePtr message, int64_t delayMs) {
-    delayMs = std::max((int64_t) 0, delayMs);
+EnqueuedMessage* MessageQueue::CreateEntry(IMessagePtr message, TimePoint time) {
+    EnqueuedMessage *m = new EnqueuedMessage();
+    m->target = message->Target();
+    m->type = message->Type();
+    m->lane = std::min(std::max((int) message->Priority(), 0), MessagePriorityCount - 1);
+    m->message = std::move(message);
+    m->time = time;
+    if (this->instrumentation.load(std::memory_order_relaxed)) {
+        m->enqueued = this->Now();
+    }
+    m->sequence = this->nextSequence.fetch_add(1);
+    if (MessageTrace* trace = this->trace.load(std::memory_order_relaxed)) {
+        trace->Add(MessageTrace::Make(
+            MessageTrace::Event::Post, this->Now(), time, *m->message));
+    }
+    return m;
+}
 
-    milliseconds now = duration_cast<milliseconds>(
-        system_clock::now().time_since_epoch());
+void MessageQueue::SetCapacity(size_t capacity, OverflowPolicy policy) {
+    LockT lock(this->queueMutex);
+    this->queueLimit = Limit { capacity, policy };
+    this->UpdateBounded();
+    this->spaceAvailable.notify_all();
+}
 
-    EnqueuedMessage *m = new EnqueuedMessage();
-    m->message = message;
-    m->time = now + milliseconds(delayMs);
+void MessageQueue::SetCapacity(IMessageTarget* target, size_t capacity, OverflowPolicy policy) {
+    LockT lock(this->queueMutex);
+    if (capacity) {
+        this->targetLimits[target] = Limit { capacity, policy };
+    }
+    else {
+        this->targetLimits.erase(target);
+    }
+    this->UpdateBounded();
+    this->spaceAvailable.notify_all();
+}
+
+MessageQueue::OverflowStats MessageQueue::GetOverflowStats() {
+    LockT lock(this->queueMutex);
+    return this->overflowStats;
+}
+
+void MessageQueue::UpdateBounded() {
+    this->bounded.store(this->queueLimit.capacity > 0 || !this->targetLimits.empty());
+}
 
-    /* the queue is time ordered. start from the front of the queue, and
-    work our way back until we find the correct place to insert the new one */
+size_t MessageQueue::Depth() {
+    size_t depth = 0;
+    for (auto& lane : this->lanes) {
+        depth += lane->Size();
+    }
+    return depth;
+}
+
+void MessageQueue::PostBounded(IMessagePtr message, TimePoint time, bool debounce) {
+    /* callers only pass a null target for broadcasts */
+    IMessageTarget* target = message->Target();
+    bool blocked = false;
 
-    typedef std::list<EnqueuedMessage*>::iterator Iterator;
-    Iterator curr = this->queue.begin();
+    while (true) {
+        ReadLockT registryLock(this->registryMutex);
 
-    while (curr != this->queue.end()) {
-        if ((*curr)->time <= m->time) {
-            curr++;
+        /* broadcasts have no target to validate */
+        if (target && this->targets.find(target) == this->targets.end()) {
+            return;
+        }
+
+        LockT lock(this->queueMutex);
+
+        if (debounce) {
+            this->RemoveLocked(target, message->Type());
         }
         else {
-            break;
+            this->DrainIntake();
+        }
+
+        switch (this->Admit(*message)) {
+            case Admission::Accept:
+                this->Enqueue(std::move(message), time);
+                return;
+            case Admission::Reject:
+                return;
+            case Admission::Wait:
+                break;
+        }
+
+        if (!blocked) {
+            ++this->overflowStats.blocked;
+            blocked = true;
+        }
+
+        /* never wait while holding the registry lock; Unregister() needs it
+        exclusively, and is one of the things that can make room. */
+        registryLock.unlock();
+
+        ++this->blockedProducers;
+        this->spaceAvailable.wait(lock);
+        --this->blockedProducers;
+    }
+}
+
+MessageQueue::Admission MessageQueue::Admit(IMessage& message) {
+    /* callers must hold queueMutex, with the intake drained */
+    if (IMessageTarget* target = message.Target()) {
+        auto it = this->targetLimits.find(target);
+        if (it != this->targetLimits.end()) {
+            Admission result = this->Apply(it->second, message, true);
+            if (result != Admission::Accept) {
+                return result;
+            }
         }
     }
 
-    bool first = (curr == this->queue.begin());
+    if (this->queueLimit.capacity) {
+        return this->Apply(this->queueLimit, message, false);
+    }
+
+    return Admission::Accept;
+}
+
+MessageQueue::Admission MessageQueue::Apply(const Limit& limit, IMessage& message, bool perTarget) {
+    IMessageTarget* target = message.Target();
 
-    this->queue.insert(curr, m);
+    auto depth = [this, target, perTarget]() {
+        return perTarget ? this->index.Count(target) : this->Depth();
+    };
 
-    if (this->queue.size()) {
-        this->nextMessageTime.store((*this->queue.begin())->time.count());
+    if (depth() < limit.capacity) {
+        return Admission::Accept;
     }
 
+    switch (limit.policy) {
+        case OverflowPolicy::Block:
+            if (dispatchingQueue == this) {
+                ++this->overflowStats.overCapacity;
+                return Admission::Accept;
+            }
+            return Admission::Wait;
+
+        case OverflowPolicy::DropNewest:
+            ++this->overflowStats.droppedNewest;
+            return Admission::Reject;
+
+        case OverflowPolicy::Coalesce:
+            if (int removed = this->RemoveLocked(target, message.Type())) {
+                this->overflowStats.coalesced += removed;
+            }
+            break;
+
+        case OverflowPolicy::DropOldest:
+            break;
+    }
+
+    /* DropOldest, or Coalesce with nothing (or not enough) to coalesce */
+    bool evicted = false;
+    while (depth() >= limit.capacity) {
+        EnqueuedMessage* oldest = perTarget ? this->index.Oldest(target) : this->Earliest();
+        if (!oldest) {
+            break;
+        }
+        this->Erase(oldest);
+        this->Release(oldest);
+        ++this->overflowStats.droppedOldest;
+        evicted = true;
+    }
+
+    if (evicted) {
+        this->UpdateNextMessageTime();
+    }
+
+    return Admission::Accept;
+}
+
+TimePoint MessageQueue::Now() {
+    return this->clock->Now();
+}
+
+TimePoint MessageQueue::FromNow(int64_t delayMs) {
+    return this->Now() + milliseconds(std::max((int64_t) 0, delayMs));
+}
+
+IClockPtr MessageQueue::GetClock() {
+    return this->clock;
+}
+
+void MessageQueue::SetTrace(MessageTrace* trace) {
+    this->trace.store(trace);
+}
+
+void MessageQueue::Enqueue(IMessagePtr message, int64_t delayMs) {
+    this->Enqueue(std::move(message), this->FromNow(delayMs));
+}
+
+void MessageQueue::Enqueue(IMessagePtr message, TimePoint time) {
+    EnqueuedMessage *m = this->CreateEntry(std::move(message), time);
+
+    this->Insert(m);
+
+    bool first = (this->Earliest() == m);
+
+    this->UpdateNextMessageTime();
+
     if (first) {
         this->waitForDispatch.notify_all();
+        this->OnDispatchTimeChanged();
+    }
+}
+
+void MessageQueue::EnqueueLockFree(IMessagePtr message) {
+    this->PushIntake(this->CreateEntry(std::move(message), this->Now()));
+    this->WakeDispatcher();
+}
+
+void MessageQueue::PushIntake(EnqueuedMessage* m) {
+    /* bump the count before the push so the consumer never sees more
+    entries than the count accounts for */
+    this->intakeCount.fetch_add(1);
+    this->intake.Push(m);
+}
+
+void MessageQueue::WakeDispatcher() {
+    this->OnDispatchTimeChanged();
+
+    if (this->waiting.load()) {
+        { LockT lock(this->queueMutex); }
+        this->waitForDispatch.notify_all();
+    }
+}
+
+void MessageQueue::DrainIntake() {
+    bool drained = false;
+    EnqueuedMessage *m = this->intake.Pop();
+    while (m) {
+        this->intakeCount.fetch_sub(1);
+        this->Insert(m);
+        drained = true;
+        m = this->intake.Pop();
+    }
+    if (drained) {
+        this->UpdateNextMessageTime();
     }
 }
 
 void MessageQueue::Debounce(IMessagePtr message, int64_t delayMs) {
-    Remove(message->Target(), message->Type());
-    Post(message, delayMs);
+    if (this->bounded.load(std::memory_order_relaxed) && message->Target()) {
+        this->PostBounded(std::move(message), this->FromNow(delayMs), true);
+        return;
+    }
+
+    ReadLockT registryLock(this->registryMutex);
+    LockT lock(this->queueMutex);
+
+    IMessageTarget* target = message->Target();
+    this->RemoveLocked(target, message->Type());
+
+    if (this->targets.find(target) == this->targets.end()) {
+        return;
+    }
+
+    this->Enqueue(message, delayMs);
 }
 
 void MessageQueue::Dispatch(IMessagePtr message) {
     if (message->Target()) {
-        message->Target()->ProcessMessage(*message);
+        this->Deliver(message->Target(), IMessageTargetPtr(), message);
     }
     else {
-        std::set<IWeakMessageTarget, WeakPtrLess> copy;
-
-        /* copy to dispatch outside of a lock */
-        {
-            LockT lock(this->queueMutex);
-            std::copy(
-                receivers.begin(),
-                receivers.end(),
-                std::inserter(copy, copy.begin()));
-        }
+        /* the receiver list is copy-on-write; grabbing the current snapshot
+        is a single pointer load, and it's immutable so we can walk it
+        without holding any locks. */
+        ReceiverListPtr snapshot = std::atomic_load(&this->receivers);
 
         /* dispatch */
         bool prune = false;
-        for (auto receiver : copy) {
-            auto shared = receiver.lock();
+        for (auto& receiver : *snapshot) {
+            auto shared = receiver.target.lock();
             if (shared) {
-                shared->ProcessMessage(*message);
+                this->Deliver(shared.get(), shared, message);
             }
             else {
                 prune = true;
@@ -314,16 +1168,16 @@ void MessageQueue::Dispatch(IMessagePtr message) {
         }
 
         if (prune) { /* at least one of our weak_ptrs is dead. */
-            LockT lock(this->queueMutex);
-            auto it = this->receivers.begin();
-            while (it != this->receivers.end()) {
-                if (it->expired()) {
-                    it = this->receivers.erase(it);
-                }
-                else {
-                    ++it;
-                }
-            }
+            LockT lock(this->receiversMutex);
+            std::atomic_store(&this->receivers, ReceiverListPtr(this->CopyLiveReceivers(nullptr)));
         }
     }
 }
+
+void MessageQueue::Deliver(
+    IMessageTarget* target,
+    const IMessageTargetPtr& /* owner */,
+    const IMessagePtr& message)
+{
+    target->ProcessMessage(*message);
+}
\ No newline at end of file
@@ -35,21 +35,39 @@
 #pragma once
 
 #include <f8n/runtime/IMessageQueue.h>
+#include <f8n/runtime/IClock.h>
+#include <f8n/runtime/TimerQueue.h>
+#include <f8n/runtime/MessageIndex.h>
+#include <f8n/runtime/MpscQueue.h>
+#include <f8n/runtime/Histogram.h>
 
-#include <list>
+#include <json.hpp>
+
+#include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 #include <chrono>
 #include <atomic>
 #include <set>
+#include <string>
+#include <unordered_map>
 
 namespace f8n { namespace runtime {
+    class MessageTrace;
+
     class MessageQueue : public IMessageQueue {
         public:
-            MessageQueue();
+            /* all scheduling decisions are made against `clock`; if it's
+            null, the queue uses SteadyClock. */
+            MessageQueue(
+                TimerQueue::Type timerQueueType = TimerQueue::Type::Heap,
+                IClockPtr clock = IClockPtr());
             virtual ~MessageQueue();
 
             virtual void Post(IMessagePtr message, int64_t delayMs = 0);
+            virtual void PostBatch(std::vector<IMessagePtr>&& messages, int64_t delayMs = 0);
+            virtual void PostAt(IMessagePtr message, std::chrono::steady_clock::time_point deadline);
             virtual void Broadcast(IMessagePtr message, int64_t messageMs = 0);
             virtual int Remove(IMessageTarget *target, int type = -1);
             virtual bool Contains(IMessageTarget *target, int type = -1);
@@ -61,36 +79,231 @@ namespace f8n { namespace runtime {
             virtual void WaitAndDispatch(int64_t timeoutMillis = -1);
             virtual void Dispatch();
 
+            struct LaneStats {
+                size_t depth;
+                uint64_t dispatched;
+                std::chrono::nanoseconds totalWait;
+                std::chrono::nanoseconds maxWait;
+            };
+
+            /* wait time is measured from when a message was due until it
+            was pulled off the queue for dispatch. */
+            LaneStats GetLaneStats(MessagePriority priority);
+
+            /* limits the number of messages handled by a single call to
+            Dispatch(); anything left over stays queued (higher priorities
+            first) and is picked up by the next call. 0 means unlimited. */
+            void SetDispatchBudget(size_t budget);
+
+            /* what happens to a message posted when its target (or the
+            queue) is already at capacity:
+              - Block: the producer waits for space. posts made from the
+                thread that is dispatching this queue are never blocked;
+                they're admitted over capacity (and counted) instead.
+              - DropOldest: the oldest pending message makes room. for a
+                target that's the first one enqueued; for the queue, the
+                one due soonest.
+              - DropNewest: the new message is discarded.
+              - Coalesce: pending messages with the same (target, type) are
+                replaced by the new one. if there are none, the oldest
+                pending message makes room. */
+            enum class OverflowPolicy: int {
+                Block = 0,
+                DropOldest = 1,
+                DropNewest = 2,
+                Coalesce = 3
+            };
+
+            struct OverflowStats {
+                uint64_t blocked;
+                uint64_t droppedOldest;
+                uint64_t droppedNewest;
+                uint64_t coalesced;
+                uint64_t overCapacity;
+            };
+
+            /* a capacity of 0 removes the limit. per-target limits are
+            checked before the queue's, and are forgotten when the target
+            is unregistered. while any limit is set, every post takes the
+            locked path. */
+            void SetCapacity(size_t capacity, OverflowPolicy policy = OverflowPolicy::Block);
+            void SetCapacity(IMessageTarget* target, size_t capacity, OverflowPolicy policy = OverflowPolicy::Block);
+            OverflowStats GetOverflowStats();
+
+            typedef uint64_t RepeatingHandle;
+
+            /* delivers `message` every `periodMs`, reusing a single queued
+            entry. deadlines advance from the ideal schedule rather than
+            from when the handler finished, so they don't drift; if the
+            queue falls behind, missed deadlines are skipped instead of
+            delivered in a burst. a non-zero `toleranceMs` lets a deadline
+            slip (later, never earlier) to the next multiple of the
+            tolerance, so timers with similar tolerances share wakeups.
+            Remove(), Debounce() and Unregister() cancel matching timers.
+            returns 0 if the target isn't registered or the period isn't
+            positive. */
+            RepeatingHandle ScheduleRepeating(
+                IMessageTarget* target,
+                int type,
+                int64_t periodMs,
+                int64_t toleranceMs = 0);
+
+            RepeatingHandle ScheduleRepeating(
+                IMessagePtr message,
+                int64_t periodMs,
+                int64_t toleranceMs = 0);
+
+            bool CancelRepeating(RepeatingHandle handle);
+
+            /* opt-in instrumentation: per-(target, type) dispatch counts,
+            enqueue-to-dispatch latency and ProcessMessage duration
+            histograms (in nanoseconds), plus queue depth and high-water
+            mark. when disabled (the default), the dispatch path pays for a
+            single null check. */
+            void EnableInstrumentation(bool enabled);
+            nlohmann::json GetStats();
+            void DumpStats(const std::string& tag = "MessageQueue");
+
+            /* opt-in monitoring, for watchdogs running on other threads:
+            Dispatch() publishes which handler it's currently inside, and
+            records loop lag -- how late the most overdue message in each
+            batch was -- in a histogram (nanoseconds). like
+            instrumentation, it costs a single null check when disabled. */
+            struct HandlerState {
+                bool busy;
+                IMessageTarget* target;
+                int type;
+                uint64_t generation; /* changes with every handler call */
+                std::chrono::nanoseconds elapsed; /* real time, not the queue's clock */
+            };
+
+            void EnableMonitoring(bool enabled);
+            HandlerState GetHandlerState();
+            Histogram GetLoopLag();
+
+            /* records every post and dispatch to `trace` until called again
+            with null. the trace is not owned, and must outlive any calls
+            made while it's attached. */
+            void SetTrace(MessageTrace* trace);
+
+            IClockPtr GetClock();
+
+            /* returns time_point::max() if nothing is queued */
+            std::chrono::steady_clock::time_point GetNextMessageTime();
+
         protected:
-            int64_t GetNextMessageTime() {
-                return nextMessageTime.load();
-            }
+
+            /* hands a due message to its target. `owner` is only set for
+            broadcast receivers, and keeps the receiver alive. subclasses may
+            override this to run the message somewhere else. */
+            virtual void Deliver(
+                IMessageTarget* target,
+                const IMessageTargetPtr& owner,
+                const IMessagePtr& message);
+
+            /* called whenever the time the next Dispatch() is needed may
+            have moved earlier -- including to "now", for zero-delay posts.
+            may be called from any thread, with internal locks held, so it
+            must not call back into the queue. subclasses that drive the
+            queue from their own event loop override this to wake it up. */
+            virtual void OnDispatchTimeChanged() { }
 
             void Enqueue(IMessagePtr message, int64_t delayMs);
+            void Enqueue(IMessagePtr message, std::chrono::steady_clock::time_point time);
+            void EnqueueLockFree(IMessagePtr message);
 
         private:
             typedef std::weak_ptr<IMessageTarget> IWeakMessageTarget;
 
-            struct EnqueuedMessage {
-                IMessagePtr message;
-                std::chrono::milliseconds time;
+            struct Receiver {
+                IMessageTarget* id; /* captured at registration; never dereferenced */
+                IWeakMessageTarget target;
             };
 
-            struct WeakPtrLess { /* https://stackoverflow.com/a/12875729 */
-                template <typename T>
-                bool operator() (const std::weak_ptr<T>& l, const std::weak_ptr<T>& r) const {
-                    return l.lock().get() < r.lock().get();
-                }
-            };
+            typedef std::vector<Receiver> ReceiverList;
+            typedef std::shared_ptr<const ReceiverList> ReceiverListPtr;
 
+            IClockPtr clock;
+            std::atomic<MessageTrace*> trace;
             std::mutex queueMutex;
-            std::list<EnqueuedMessage*> queue;
-            std::list<EnqueuedMessage*> dispatch;
-            std::set<IWeakMessageTarget, WeakPtrLess> receivers;
-            std::set<IMessageTarget*> targets;
+            std::unique_ptr<TimerQueue> lanes[MessagePriorityCount];
+            LaneStats laneStats[MessagePriorityCount];
+            size_t dispatchBudget;
+            MessageIndex index;
+            std::vector<EnqueuedMessage*> matches;
+            std::vector<EnqueuedMessage*> dispatch;
             std::condition_variable_any waitForDispatch;
-            std::atomic<int64_t> nextMessageTime;
+            std::atomic<int64_t> nextMessageTime; /* steady_clock ticks, or -1 */
+            std::atomic<uint64_t> nextSequence;
+
+            /* zero-delay posts bypass queueMutex entirely; they're pushed
+            here and moved into the time queue by whoever next holds the
+            lock. registration is guarded separately so Post() only ever
+            needs a shared lock to validate its target. */
+            MpscQueue<EnqueuedMessage> intake;
+            std::atomic<int64_t> intakeCount;
+            std::atomic<bool> waiting;
+            std::shared_mutex registryMutex;
+            std::set<IMessageTarget*> targets;
+
+            /* an immutable snapshot, replaced wholesale (under receiversMutex)
+            whenever the set of broadcast receivers changes. always accessed
+            via std::atomic_load/std::atomic_store. */
+            ReceiverListPtr receivers;
+            std::mutex receiversMutex;
+
+            struct Limit {
+                size_t capacity;
+                OverflowPolicy policy;
+            };
+
+            enum class Admission: int { Accept, Reject, Wait };
+
+            /* all guarded by queueMutex, except `bounded`, which lets the
+            unbounded case skip all of this with a single load. */
+            std::atomic<bool> bounded;
+            Limit queueLimit;
+            std::unordered_map<IMessageTarget*, Limit> targetLimits;
+            OverflowStats overflowStats;
+            std::condition_variable_any spaceAvailable;
+            size_t blockedProducers;
+
+            /* guarded by queueMutex. `reschedule` collects the repeating
+            entries delivered by the current Dispatch(); they're put back
+            into the queue once delivery is done. */
+            RepeatingHandle nextRepeatingHandle;
+            std::unordered_map<RepeatingHandle, EnqueuedMessage*> repeating;
+            size_t repeatingInFlight;
+            std::vector<EnqueuedMessage*> reschedule;
+
+            struct Instrumentation;
+            std::unique_ptr<Instrumentation> instrumentationData;
+            std::atomic<Instrumentation*> instrumentation;
+
+            struct Monitor;
+            std::unique_ptr<Monitor> monitorData;
+            std::atomic<Monitor*> monitor;
 
+            void Reschedule();
+            void Release(EnqueuedMessage* message);
+            void PostBounded(IMessagePtr message, std::chrono::steady_clock::time_point time, bool debounce);
+            Admission Admit(IMessage& message);
+            Admission Apply(const Limit& limit, IMessage& message, bool perTarget);
+            void UpdateBounded();
+            size_t Depth();
+            std::chrono::steady_clock::time_point Now();
+            std::chrono::steady_clock::time_point FromNow(int64_t delayMs);
+            EnqueuedMessage* CreateEntry(IMessagePtr message, std::chrono::steady_clock::time_point time);
+            EnqueuedMessage* Earliest();
+            std::shared_ptr<ReceiverList> CopyLiveReceivers(IMessageTarget* exclude);
+            void Insert(EnqueuedMessage* message);
+            void Erase(EnqueuedMessage* message);
+            void PushIntake(EnqueuedMessage* message);
+            void WakeDispatcher();
+            void DrainIntake();
+            int RemoveLocked(IMessageTarget *target, int type);
+            void UpdateNextMessageTime();
+            void DispatchInstrumented(Instrumentation* instrumentation, Monitor* monitor);
             void Dispatch(IMessagePtr message);
     };
 } }
\ No newline at end of file
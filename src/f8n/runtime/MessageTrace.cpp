@@ -0,0 +1,296 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/MessageTrace.h>
+#include <f8n/runtime/MessageQueue.h>
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/Clock.h>
+
+#include <algorithm>
+#include <fstream>
+
+using namespace std::chrono;
+using namespace f8n::runtime;
+
+using LockT = std::unique_lock<std::mutex>;
+using TimePoint = steady_clock::time_point;
+using Record = MessageTrace::Record;
+
+static inline TimePoint toTimePoint(int64_t ticks) {
+    return TimePoint(TimePoint::duration(ticks));
+}
+
+/* MessageTrace */
+
+Record MessageTrace::Make(Event event, TimePoint time, TimePoint due, IMessage& message) {
+    Record record;
+    record.event = event;
+    record.time = time.time_since_epoch().count();
+    record.due = due.time_since_epoch().count();
+    record.target = (uint64_t) reinterpret_cast<uintptr_t>(message.Target());
+    record.type = message.Type();
+    record.data1 = message.UserData1();
+    record.data2 = message.UserData2();
+    record.priority = (int) message.Priority();
+    return record;
+}
+
+void MessageTrace::Add(const Record& record) {
+    LockT lock(this->mutex);
+    this->records.push_back(record);
+}
+
+std::vector<Record> MessageTrace::Records() {
+    LockT lock(this->mutex);
+    return this->records;
+}
+
+size_t MessageTrace::Size() {
+    LockT lock(this->mutex);
+    return this->records.size();
+}
+
+void MessageTrace::Clear() {
+    LockT lock(this->mutex);
+    this->records.clear();
+}
+
+nlohmann::json MessageTrace::ToJson() {
+    LockT lock(this->mutex);
+    nlohmann::json result = nlohmann::json::array();
+    for (auto& record : this->records) {
+        result.push_back({
+            (int) record.event,
+            record.time,
+            record.due,
+            record.target,
+            record.type,
+            record.data1,
+            record.data2,
+            record.priority
+        });
+    }
+    return result;
+}
+
+bool MessageTrace::FromJson(const nlohmann::json& json) {
+    std::vector<Record> parsed;
+    try {
+        for (auto& entry : json) {
+            Record record;
+            record.event = (Event) entry.at(0).get<int>();
+            record.time = entry.at(1).get<int64_t>();
+            record.due = entry.at(2).get<int64_t>();
+            record.target = entry.at(3).get<uint64_t>();
+            record.type = entry.at(4).get<int>();
+            record.data1 = entry.at(5).get<int64_t>();
+            record.data2 = entry.at(6).get<int64_t>();
+            record.priority = entry.at(7).get<int>();
+            parsed.push_back(record);
+        }
+    }
+    catch (...) {
+        return false;
+    }
+
+    LockT lock(this->mutex);
+    this->records.swap(parsed);
+    return true;
+}
+
+bool MessageTrace::Save(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        return false;
+    }
+    out << this->ToJson().dump();
+    return out.good();
+}
+
+bool MessageTrace::Load(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        return false;
+    }
+    try {
+        nlohmann::json json;
+        in >> json;
+        return this->FromJson(json);
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+/* MessageTraceReplayer */
+
+class MessageTraceReplayer::Proxy : public IMessageTarget {
+    public:
+        Proxy(MessageTraceReplayer& replayer, uint64_t id)
+        : replayer(replayer), id(id) {
+        }
+
+        virtual void ProcessMessage(IMessage& message) override {
+            this->replayer.OnDispatched(this->id, message);
+        }
+
+    private:
+        MessageTraceReplayer& replayer;
+        uint64_t id;
+};
+
+MessageTraceReplayer::MessageTraceReplayer(MessageQueue& queue, VirtualClock& clock)
+: queue(queue)
+, clock(clock)
+, forward(nullptr)
+, dispatched(0)
+, outOfOrder(0) {
+}
+
+MessageTraceReplayer::~MessageTraceReplayer() {
+    for (auto& it : this->proxies) {
+        this->queue.Unregister(it.second.get());
+    }
+}
+
+void MessageTraceReplayer::SetForward(IMessageTarget* forward) {
+    this->forward = forward;
+}
+
+MessageTraceReplayer::Proxy* MessageTraceReplayer::ProxyFor(uint64_t id) {
+    auto it = this->proxies.find(id);
+    if (it != this->proxies.end()) {
+        return it->second.get();
+    }
+    Proxy* proxy = new Proxy(*this, id);
+    this->proxies[id].reset(proxy);
+    this->queue.Register(proxy);
+    return proxy;
+}
+
+void MessageTraceReplayer::OnDispatched(uint64_t id, IMessage& message) {
+    if (this->dispatched >= this->expected.size()) {
+        ++this->outOfOrder;
+    }
+    else {
+        const Record& expected = this->expected[this->dispatched];
+        if (expected.target != id ||
+            expected.type != message.Type() ||
+            expected.data1 != message.UserData1() ||
+            expected.data2 != message.UserData2())
+        {
+            ++this->outOfOrder;
+        }
+    }
+
+    ++this->dispatched;
+
+    if (this->forward) {
+        this->forward->ProcessMessage(message);
+    }
+}
+
+MessageTraceReplayer::Result MessageTraceReplayer::Replay(MessageTrace& trace) {
+    std::vector<Record> timeline = trace.Records();
+
+    /* records are appended as events happen, but concurrent producers may
+    interleave slightly out of time order. */
+    std::stable_sort(timeline.begin(), timeline.end(),
+        [](const Record& a, const Record& b) {
+            return a.time < b.time;
+        });
+
+    this->expected.clear();
+    this->dispatched = 0;
+    this->outOfOrder = 0;
+
+    for (auto& record : timeline) {
+        if (record.event == MessageTrace::Event::Dispatch) {
+            this->expected.push_back(record);
+        }
+    }
+
+    /* recorded times are rebased so the trace starts at the clock's
+    current time */
+    const TimePoint start = this->clock.Now();
+    const int64_t origin = timeline.empty() ? 0 : timeline.front().time;
+    auto rebase = [start, origin](int64_t ticks) {
+        return start + TimePoint::duration(ticks - origin);
+    };
+
+    const auto wallStart = steady_clock::now();
+
+    /* posts and dispatches happen at the recorded times, so messages are
+    dispatched in the same batches they originally were... */
+    size_t posted = 0;
+    int64_t lastDispatch = -1;
+    for (auto& record : timeline) {
+        this->clock.Set(rebase(record.time));
+        if (record.event == MessageTrace::Event::Post) {
+            this->queue.PostAt(
+                Message::Create(
+                    this->ProxyFor(record.target),
+                    record.type,
+                    record.data1,
+                    record.data2,
+                    (MessagePriority) record.priority),
+                rebase(record.due));
+            ++posted;
+        }
+        else if (record.time != lastDispatch) {
+            this->queue.Dispatch();
+            lastDispatch = record.time;
+        }
+    }
+
+    /* ...then anything still queued (e.g. the recording stopped early)
+    runs as soon as it's due. */
+    TimePoint next = this->queue.GetNextMessageTime();
+    while (next != TimePoint::max()) {
+        this->clock.Set(next);
+        this->queue.Dispatch();
+        next = this->queue.GetNextMessageTime();
+    }
+
+    Result result;
+    result.posted = posted;
+    result.dispatched = this->dispatched;
+    result.outOfOrder = this->outOfOrder + (this->expected.size() > this->dispatched
+        ? this->expected.size() - this->dispatched : 0);
+    result.simulated = duration_cast<nanoseconds>(this->clock.Now() - start);
+    result.elapsed = duration_cast<nanoseconds>(steady_clock::now() - wallStart);
+    result.throughput = result.elapsed.count() > 0
+        ? (double) result.dispatched * 1e9 / (double) result.elapsed.count() : 0.0;
+    return result;
+}
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/IMessage.h>
+#include <f8n/runtime/IMessageTarget.h>
+
+#include <json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace f8n { namespace runtime {
+
+    class MessageQueue;
+    class VirtualClock;
+
+    /* a recording of a queue's traffic: every message posted and every
+    message dispatched, with the queue clock's time for each. attach one
+    with MessageQueue::SetTrace(); replay it with MessageTraceReplayer. */
+    class MessageTrace {
+        public:
+            enum class Event: int {
+                Post = 0,
+                Dispatch = 1
+            };
+
+            struct Record {
+                Event event;
+                int64_t time; /* queue clock ticks when the event happened */
+                int64_t due; /* queue clock ticks the message was due */
+                uint64_t target; /* opaque id of the target; 0 for broadcasts */
+                int type;
+                int64_t data1, data2;
+                int priority;
+            };
+
+            static Record Make(
+                Event event,
+                std::chrono::steady_clock::time_point time,
+                std::chrono::steady_clock::time_point due,
+                IMessage& message);
+
+            void Add(const Record& record);
+            std::vector<Record> Records();
+            size_t Size();
+            void Clear();
+
+            nlohmann::json ToJson();
+            bool FromJson(const nlohmann::json& json);
+
+            bool Save(const std::string& filename);
+            bool Load(const std::string& filename);
+
+        private:
+            std::mutex mutex;
+            std::vector<Record> records;
+    };
+
+    /* replays a recorded trace into a queue driven by a VirtualClock, as
+    fast as the CPU allows. posts and Dispatch() calls happen at their
+    recorded times, so the queue sees the same batches it originally did.
+    each original target is stood in for by a proxy target owned by the
+    replayer (broadcasts are delivered to a proxy of their own), and
+    proxies forward to an optional target. the order in which the proxies
+    receive messages is compared against the recorded dispatch order. */
+    class MessageTraceReplayer {
+        public:
+            struct Result {
+                size_t posted;
+                size_t dispatched;
+                size_t outOfOrder; /* dispatches that differ from the recording */
+                std::chrono::nanoseconds simulated; /* virtual time covered */
+                std::chrono::nanoseconds elapsed; /* wall time it took */
+                double throughput; /* dispatches per wall-clock second */
+            };
+
+            MessageTraceReplayer(MessageQueue& queue, VirtualClock& clock);
+            ~MessageTraceReplayer();
+
+            /* receives every replayed message; may be null */
+            void SetForward(IMessageTarget* forward);
+
+            Result Replay(MessageTrace& trace);
+
+        private:
+            class Proxy;
+
+            Proxy* ProxyFor(uint64_t id);
+            void OnDispatched(uint64_t id, IMessage& message);
+
+            MessageQueue& queue;
+            VirtualClock& clock;
+            IMessageTarget* forward;
+            std::map<uint64_t, std::unique_ptr<Proxy>> proxies;
+            std::vector<MessageTrace::Record> expected;
+            size_t dispatched;
+            size_t outOfOrder;
+    };
+
+} }
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+
+namespace f8n { namespace runtime {
+
+    /* an intrusive, lock-free, multi-producer single-consumer queue, after
+    Dmitry Vyukov's design. T must expose a `std::atomic<T*> link` member.
+    Push() may be called from any thread; Pop() must only ever be called by
+    one thread at a time. Pop() may return nullptr while a producer is in
+    the middle of a Push(); callers should simply try again later. */
+    template <typename T>
+    class MpscQueue {
+        public:
+            MpscQueue() {
+                this->stub.link.store(nullptr, std::memory_order_relaxed);
+                this->head.store(&this->stub, std::memory_order_relaxed);
+                this->tail = &this->stub;
+            }
+
+            MpscQueue(const MpscQueue&) = delete;
+
+            void Push(T* node) {
+                node->link.store(nullptr, std::memory_order_relaxed);
+                T* prev = this->head.exchange(node, std::memory_order_acq_rel);
+                prev->link.store(node, std::memory_order_release);
+            }
+
+            T* Pop() {
+                T* tail = this->tail;
+                T* next = tail->link.load(std::memory_order_acquire);
+
+                if (tail == &this->stub) {
+                    if (!next) {
+                        return nullptr;
+                    }
+                    this->tail = next;
+                    tail = next;
+                    next = next->link.load(std::memory_order_acquire);
+                }
+
+                if (next) {
+                    this->tail = next;
+                    return tail;
+                }
+
+                if (tail != this->head.load(std::memory_order_acquire)) {
+                    return nullptr; /* a producer is mid-push */
+                }
+
+                this->Push(&this->stub);
+
+                next = tail->link.load(std::memory_order_acquire);
+                if (next) {
+                    this->tail = next;
+                    return tail;
+                }
+
+                return nullptr;
+            }
+
+        private:
+            std::atomic<T*> head;
+            T* tail;
+            T stub;
+    };
+
+} }
@@ -0,0 +1,194 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace f8n { namespace runtime {
+
+    /* a process-wide free list of fixed-size blocks. each thread keeps a
+    small cache of blocks so the common path is a couple of pointer swaps;
+    caches exchange blocks with the shared list in batches. blocks are only
+    returned to the heap when the shared list grows past a high-water mark,
+    so steady-state allocate/free cycles never touch the general heap. */
+    template <size_t Size, size_t Alignment>
+    class BlockPool {
+        public:
+            static void* Allocate() {
+                Cache& cache = LocalCache();
+                if (!cache.head) {
+                    Refill(cache);
+                }
+                if (cache.head) {
+                    Block* block = cache.head;
+                    cache.head = block->next;
+                    --cache.count;
+                    return block;
+                }
+                Shared().heapAllocations.fetch_add(1, std::memory_order_relaxed);
+                return ::operator new(BlockSize, std::align_val_t(BlockAlignment));
+            }
+
+            static void Deallocate(void* memory) {
+                Cache& cache = LocalCache();
+                Block* block = static_cast<Block*>(memory);
+                block->next = cache.head;
+                cache.head = block;
+                if (++cache.count >= CacheSize * 2) {
+                    Flush(cache, CacheSize);
+                }
+            }
+
+            /* number of times the pool had to fall back to the heap */
+            static size_t HeapAllocations() {
+                return Shared().heapAllocations.load(std::memory_order_relaxed);
+            }
+
+        private:
+            struct Block {
+                Block* next;
+            };
+
+            static constexpr size_t CacheSize = 64;
+            static constexpr size_t SharedLimit = 64 * 1024;
+            static constexpr size_t BlockAlignment =
+                Alignment > alignof(Block) ? Alignment : alignof(Block);
+            static constexpr size_t BlockSize =
+                ((Size > sizeof(Block) ? Size : sizeof(Block)) + BlockAlignment - 1)
+                    / BlockAlignment * BlockAlignment;
+
+            struct SharedList {
+                std::mutex mutex;
+                Block* head { nullptr };
+                size_t count { 0 };
+                std::atomic<size_t> heapAllocations { 0 };
+            };
+
+            struct Cache {
+                Block* head { nullptr };
+                size_t count { 0 };
+                ~Cache() {
+                    Flush(*this, 0);
+                }
+            };
+
+            static SharedList& Shared() {
+                /* intentionally leaked: thread caches flush into it during
+                thread (and process) teardown. */
+                static SharedList* shared = new SharedList();
+                return *shared;
+            }
+
+            static Cache& LocalCache() {
+                thread_local Cache cache;
+                return cache;
+            }
+
+            static void Refill(Cache& cache) {
+                SharedList& shared = Shared();
+                std::unique_lock<std::mutex> lock(shared.mutex);
+                while (shared.head && cache.count < CacheSize) {
+                    Block* block = shared.head;
+                    shared.head = block->next;
+                    --shared.count;
+                    block->next = cache.head;
+                    cache.head = block;
+                    ++cache.count;
+                }
+            }
+
+            static void Flush(Cache& cache, size_t keep) {
+                SharedList& shared = Shared();
+                std::unique_lock<std::mutex> lock(shared.mutex);
+                while (cache.count > keep) {
+                    Block* block = cache.head;
+                    cache.head = block->next;
+                    --cache.count;
+                    if (shared.count < SharedLimit) {
+                        block->next = shared.head;
+                        shared.head = block;
+                        ++shared.count;
+                    }
+                    else {
+                        ::operator delete(block, std::align_val_t(BlockAlignment));
+                    }
+                }
+            }
+    };
+
+    /* an allocator backed by BlockPool; intended for std::allocate_shared so
+    an object and its control block come from a single pooled block. */
+    template <typename T>
+    class PoolAllocator {
+        public:
+            using value_type = T;
+
+            PoolAllocator() noexcept { }
+
+            template <typename U>
+            PoolAllocator(const PoolAllocator<U>&) noexcept { }
+
+            T* allocate(size_t n) {
+                if (n == 1) {
+                    return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::Allocate());
+                }
+                return std::allocator<T>().allocate(n);
+            }
+
+            void deallocate(T* p, size_t n) {
+                if (n == 1) {
+                    BlockPool<sizeof(T), alignof(T)>::Deallocate(p);
+                }
+                else {
+                    std::allocator<T>().deallocate(p, n);
+                }
+            }
+
+            template <typename U>
+            bool operator==(const PoolAllocator<U>&) const noexcept {
+                return true;
+            }
+
+            template <typename U>
+            bool operator!=(const PoolAllocator<U>&) const noexcept {
+                return false;
+            }
+    };
+
+} }
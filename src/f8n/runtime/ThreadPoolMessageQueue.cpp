@@ -0,0 +1,322 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/ThreadPoolMessageQueue.h>
+#include <algorithm>
+
+using namespace f8n::runtime;
+
+using LockT = std::unique_lock<std::mutex>;
+
+/* how many messages a worker runs from one strand before putting it back
+on its deque, so a chatty target can't monopolize a thread */
+static const int STRAND_BUDGET = 32;
+
+static thread_local void* currentStrand = nullptr;
+
+ThreadPoolMessageQueue::ThreadPoolMessageQueue(
+    size_t threadCount,
+    TimerQueue::Type timerQueueType,
+    IClockPtr clock)
+: MessageQueue(timerQueueType, clock)
+, queued(0)
+, stopping(false) {
+    this->nextWorker.store(0);
+
+    threadCount = std::max((size_t) 1, threadCount);
+
+    for (size_t i = 0; i < threadCount; i++) {
+        this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+
+    for (size_t i = 0; i < threadCount; i++) {
+        this->workers[i]->thread = std::thread(
+            &ThreadPoolMessageQueue::WorkerProc, this, i);
+    }
+}
+
+ThreadPoolMessageQueue::~ThreadPoolMessageQueue() {
+    {
+        LockT lock(this->idleMutex);
+        this->stopping = true;
+    }
+
+    this->workAvailable.notify_all();
+
+    for (auto& worker : this->workers) {
+        worker->thread.join();
+    }
+
+    /* retired strands are no longer in the map, but may still be sitting
+    in a worker's deque waiting to be cleaned up. */
+    for (auto& worker : this->workers) {
+        for (auto strand : worker->strands) {
+            if (strand->retired) {
+                delete strand;
+            }
+        }
+    }
+
+    for (auto& it : this->strands) {
+        delete it.second;
+    }
+}
+
+void ThreadPoolMessageQueue::Deliver(
+    IMessageTarget* target,
+    const IMessageTargetPtr& owner,
+    const IMessagePtr& message)
+{
+    Strand* strand = nullptr;
+    bool schedule = false;
+
+    {
+        LockT lock(this->strandsMutex);
+
+        /* Dispatch() checks registration before handing off, but doesn't
+        hold the registry lock while calling us. if the target was
+        unregistered in that window, drop the message here; Retire() does
+        its discarding under this same lock, so nothing slips through. */
+        auto& allowed = owner ? this->broadcastReceivers : this->registered;
+        if (allowed.find(target) == allowed.end()) {
+            return;
+        }
+
+        Strand*& entry = this->strands[target];
+        if (!entry) {
+            entry = new Strand();
+        }
+        strand = entry;
+
+        LockT strandLock(strand->mutex);
+        strand->pending.push_back({ target, owner, message });
+        if (!strand->scheduled) {
+            strand->scheduled = schedule = true;
+        }
+    }
+
+    if (schedule) {
+        this->Schedule(strand, this->nextWorker.fetch_add(1) % this->workers.size());
+    }
+}
+
+void ThreadPoolMessageQueue::Schedule(Strand* strand, size_t index) {
+    {
+        Worker& worker = *this->workers[index];
+        LockT lock(worker.mutex);
+        worker.strands.push_back(strand);
+    }
+
+    {
+        LockT lock(this->idleMutex);
+        ++this->queued;
+    }
+
+    this->workAvailable.notify_one();
+}
+
+ThreadPoolMessageQueue::Strand* ThreadPoolMessageQueue::Take(size_t index) {
+    Strand* strand = nullptr;
+
+    /* newest work from our own deque first (it's likely warm in cache),
+    then the oldest work from everyone else's */
+    {
+        Worker& worker = *this->workers[index];
+        LockT lock(worker.mutex);
+        if (worker.strands.size()) {
+            strand = worker.strands.back();
+            worker.strands.pop_back();
+        }
+    }
+
+    for (size_t i = 1; !strand && i < this->workers.size(); i++) {
+        Worker& victim = *this->workers[(index + i) % this->workers.size()];
+        LockT lock(victim.mutex);
+        if (victim.strands.size()) {
+            strand = victim.strands.front();
+            victim.strands.pop_front();
+        }
+    }
+
+    if (strand) {
+        LockT lock(this->idleMutex);
+        --this->queued;
+    }
+
+    return strand;
+}
+
+void ThreadPoolMessageQueue::WorkerProc(size_t index) {
+    while (true) {
+        Strand* strand = this->Take(index);
+
+        if (strand) {
+            this->Run(strand, index);
+            continue;
+        }
+
+        LockT lock(this->idleMutex);
+        while (this->queued == 0 && !this->stopping) {
+            this->workAvailable.wait(lock);
+        }
+        if (this->stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPoolMessageQueue::Run(Strand* strand, size_t index) {
+    currentStrand = strand;
+
+    for (int i = 0; i < STRAND_BUDGET; i++) {
+        Work work;
+
+        {
+            LockT lock(strand->mutex);
+
+            if (strand->pending.empty()) {
+                strand->scheduled = false;
+                bool release = strand->retired && strand->waiters == 0;
+                lock.unlock();
+                if (release) {
+                    delete strand;
+                }
+                currentStrand = nullptr;
+                return;
+            }
+
+            work = std::move(strand->pending.front());
+            strand->pending.pop_front();
+            strand->running = true;
+        }
+
+        work.target->ProcessMessage(*work.message);
+
+        {
+            LockT lock(strand->mutex);
+            strand->running = false;
+            if (strand->waiters) {
+                strand->idle.notify_all();
+            }
+        }
+    }
+
+    currentStrand = nullptr;
+
+    /* budget exhausted; let other strands have a turn. the strand is still
+    marked as scheduled, so no one else will have queued it. */
+    this->Schedule(strand, index);
+}
+
+void ThreadPoolMessageQueue::Register(IMessageTarget* target) {
+    {
+        LockT lock(this->strandsMutex);
+        this->registered.insert(target);
+    }
+    MessageQueue::Register(target);
+}
+
+void ThreadPoolMessageQueue::RegisterForBroadcasts(IMessageTargetPtr target) {
+    {
+        LockT lock(this->strandsMutex);
+        this->broadcastReceivers.insert(target.get());
+    }
+    MessageQueue::RegisterForBroadcasts(target);
+}
+
+void ThreadPoolMessageQueue::Unregister(IMessageTarget* target) {
+    MessageQueue::Unregister(target);
+    this->Retire(target, false);
+}
+
+void ThreadPoolMessageQueue::UnregisterForBroadcasts(IMessageTarget* target) {
+    MessageQueue::UnregisterForBroadcasts(target);
+    this->Retire(target, true);
+}
+
+void ThreadPoolMessageQueue::Retire(IMessageTarget* target, bool broadcasts) {
+    LockT lock(this->strandsMutex);
+
+    (broadcasts ? this->broadcastReceivers : this->registered).erase(target);
+
+    auto it = this->strands.find(target);
+    if (it == this->strands.end()) {
+        return;
+    }
+
+    Strand* strand = it->second;
+    LockT strandLock(strand->mutex);
+
+    /* only discard the kind of work we're unregistering; a target can
+    be both registered and a broadcast receiver. once it's neither, the
+    strand is done for good. */
+    const bool retire =
+        this->registered.find(target) == this->registered.end() &&
+        this->broadcastReceivers.find(target) == this->broadcastReceivers.end();
+
+    if (retire) {
+        this->strands.erase(it);
+    }
+
+    lock.unlock();
+
+    auto& pending = strand->pending;
+    pending.erase(
+        std::remove_if(pending.begin(), pending.end(), [broadcasts](const Work& work) {
+            return (work.owner != nullptr) == broadcasts;
+        }),
+        pending.end());
+
+    if (retire) {
+        strand->retired = true;
+    }
+
+    /* whoever observes the strand retired, unscheduled, and without any
+    waiters is responsible for freeing it: either us, or the worker that
+    currently has it scheduled. */
+    if (currentStrand != strand) {
+        ++strand->waiters;
+        while (strand->running) {
+            strand->idle.wait(strandLock);
+        }
+        --strand->waiters;
+    }
+
+    bool release = strand->retired && !strand->scheduled && strand->waiters == 0;
+    strandLock.unlock();
+
+    if (release) {
+        delete strand;
+    }
+}
@@ -0,0 +1,136 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/MessageQueue.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace f8n { namespace runtime {
+
+    /* a MessageQueue whose messages are processed by a pool of worker
+    threads. timing, registration, and ordering work exactly like the
+    regular MessageQueue -- one thread still calls WaitAndDispatch() or
+    Dispatch() -- but due messages are handed off to the pool instead of
+    being processed inline.
+
+    messages for the same IMessageTarget are processed in the order they
+    were dispatched, and never concurrently. messages for different
+    targets run in parallel. each target gets a "strand" (a FIFO of its
+    pending messages); a strand is scheduled on at most one worker's
+    deque at a time. idle workers steal strands from busy ones. */
+    class ThreadPoolMessageQueue : public MessageQueue {
+        public:
+            ThreadPoolMessageQueue(
+                size_t threadCount = std::thread::hardware_concurrency(),
+                TimerQueue::Type timerQueueType = TimerQueue::Type::Heap,
+                IClockPtr clock = IClockPtr());
+
+            virtual ~ThreadPoolMessageQueue();
+
+            virtual void Register(IMessageTarget* target) override;
+            virtual void RegisterForBroadcasts(IMessageTargetPtr target) override;
+
+            /* in addition to removing queued messages, these discard any of
+            the target's direct (or broadcast) messages already handed to the
+            pool, and wait for an in-progress message to finish (unless
+            called from that message's own handler). once Unregister()
+            returns, the target will not be called with another direct
+            message; once UnregisterForBroadcasts() returns, it will not be
+            called with another broadcast. */
+            virtual void Unregister(IMessageTarget* target) override;
+            virtual void UnregisterForBroadcasts(IMessageTarget *target) override;
+
+            size_t ThreadCount() const {
+                return this->workers.size();
+            }
+
+        protected:
+            virtual void Deliver(
+                IMessageTarget* target,
+                const IMessageTargetPtr& owner,
+                const IMessagePtr& message) override;
+
+        private:
+            struct Work {
+                IMessageTarget* target;
+                IMessageTargetPtr owner;
+                IMessagePtr message;
+            };
+
+            struct Strand {
+                std::mutex mutex;
+                std::condition_variable idle;
+                std::deque<Work> pending;
+                bool scheduled { false };
+                bool running { false };
+                bool retired { false };
+                int waiters { 0 };
+            };
+
+            struct Worker {
+                std::mutex mutex;
+                std::deque<Strand*> strands;
+                std::thread thread;
+            };
+
+            void WorkerProc(size_t index);
+            void Schedule(Strand* strand, size_t worker);
+            Strand* Take(size_t index);
+            void Run(Strand* strand, size_t index);
+            void Retire(IMessageTarget* target, bool broadcasts);
+
+            std::vector<std::unique_ptr<Worker>> workers;
+            std::mutex strandsMutex;
+            std::unordered_map<IMessageTarget*, Strand*> strands;
+            /* mirrors of the base class registries, guarded by strandsMutex
+            so Deliver() and Retire() agree on who may still be called */
+            std::unordered_set<IMessageTarget*> registered;
+            std::unordered_set<IMessageTarget*> broadcastReceivers;
+            std::mutex idleMutex;
+            std::condition_variable workAvailable;
+            size_t queued;
+            bool stopping;
+            std::atomic<size_t> nextWorker;
+    };
+
+} }
@@ -0,0 +1,185 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/TimerQueue.h>
+#include <algorithm>
+
+using namespace f8n::runtime;
+
+using EnqueuedMessagePool = BlockPool<sizeof(EnqueuedMessage), alignof(EnqueuedMessage)>;
+
+void* EnqueuedMessage::operator new(size_t /* size */) {
+    return EnqueuedMessagePool::Allocate();
+}
+
+void EnqueuedMessage::operator delete(void* memory) {
+    EnqueuedMessagePool::Deallocate(memory);
+}
+
+TimerQueue* TimerQueue::Create(Type type) {
+    switch (type) {
+        case Type::List: return new ListTimerQueue();
+        case Type::Heap: return new HeapTimerQueue();
+    }
+    return new HeapTimerQueue();
+}
+
+/* ListTimerQueue */
+
+void ListTimerQueue::Push(EnqueuedMessage* message) {
+    /* the queue is time ordered. start from the front of the queue, and
+    work our way back until we find the correct place to insert the new one */
+    auto curr = this->queue.begin();
+    while (curr != this->queue.end() && !Earlier(message, *curr)) {
+        ++curr;
+    }
+    this->queue.insert(curr, message);
+}
+
+EnqueuedMessage* ListTimerQueue::Top() {
+    return this->queue.size() ? this->queue.front() : nullptr;
+}
+
+EnqueuedMessage* ListTimerQueue::Pop() {
+    if (this->queue.size()) {
+        EnqueuedMessage* front = this->queue.front();
+        this->queue.pop_front();
+        return front;
+    }
+    return nullptr;
+}
+
+void ListTimerQueue::Erase(EnqueuedMessage* message) {
+    auto it = std::find(this->queue.begin(), this->queue.end(), message);
+    if (it != this->queue.end()) {
+        this->queue.erase(it);
+    }
+}
+
+void ListTimerQueue::ForEach(std::function<void(EnqueuedMessage*)> callback) {
+    for (auto message : this->queue) {
+        callback(message);
+    }
+}
+
+size_t ListTimerQueue::Size() {
+    return this->queue.size();
+}
+
+/* HeapTimerQueue */
+
+void HeapTimerQueue::Push(EnqueuedMessage* message) {
+    this->heap.push_back(message);
+    message->position = this->heap.size() - 1;
+    this->SiftUp(message->position);
+}
+
+EnqueuedMessage* HeapTimerQueue::Top() {
+    return this->heap.size() ? this->heap.front() : nullptr;
+}
+
+EnqueuedMessage* HeapTimerQueue::Pop() {
+    EnqueuedMessage* top = this->Top();
+    if (top) {
+        this->Erase(top);
+    }
+    return top;
+}
+
+void HeapTimerQueue::Erase(EnqueuedMessage* message) {
+    const size_t index = message->position;
+
+    if (index >= this->heap.size() || this->heap[index] != message) {
+        return;
+    }
+
+    EnqueuedMessage* last = this->heap.back();
+    this->heap.pop_back();
+
+    if (last != message) {
+        /* move the last element into the hole, then restore the heap
+        property in whichever direction it was violated */
+        this->Place(index, last);
+        this->SiftDown(index);
+        this->SiftUp(last->position);
+    }
+}
+
+void HeapTimerQueue::ForEach(std::function<void(EnqueuedMessage*)> callback) {
+    for (auto message : this->heap) {
+        callback(message);
+    }
+}
+
+size_t HeapTimerQueue::Size() {
+    return this->heap.size();
+}
+
+void HeapTimerQueue::Place(size_t index, EnqueuedMessage* message) {
+    this->heap[index] = message;
+    message->position = index;
+}
+
+void HeapTimerQueue::SiftUp(size_t index) {
+    EnqueuedMessage* message = this->heap[index];
+    while (index > 0) {
+        const size_t parent = (index - 1) / 2;
+        if (!Earlier(message, this->heap[parent])) {
+            break;
+        }
+        this->Place(index, this->heap[parent]);
+        index = parent;
+    }
+    this->Place(index, message);
+}
+
+void HeapTimerQueue::SiftDown(size_t index) {
+    const size_t size = this->heap.size();
+    EnqueuedMessage* message = this->heap[index];
+    while (true) {
+        size_t child = (index * 2) + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && Earlier(this->heap[child + 1], this->heap[child])) {
+            ++child;
+        }
+        if (!Earlier(this->heap[child], message)) {
+            break;
+        }
+        this->Place(index, this->heap[child]);
+        index = child;
+    }
+    this->Place(index, message);
+}
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/IMessage.h>
+#include <f8n/runtime/Pool.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <vector>
+
+namespace f8n { namespace runtime {
+
+    struct MessageIndexBucket;
+
+    struct RepeatingTimer;
+
+    struct EnqueuedMessage final { /* final: allocated from a pool sized for exactly this */
+        IMessagePtr message;
+        IMessageTarget* target;
+        int type;
+        int lane;
+        std::chrono::steady_clock::time_point time;
+        std::chrono::steady_clock::time_point enqueued; /* only set when instrumented */
+        uint64_t sequence;
+        size_t position;
+        RepeatingTimer* repeating; /* only set by ScheduleRepeating() */
+
+        /* MessageIndex bookkeeping */
+        MessageIndexBucket* bucket;
+        EnqueuedMessage* prev;
+        EnqueuedMessage* next;
+
+        /* MpscQueue bookkeeping */
+        std::atomic<EnqueuedMessage*> link;
+
+        static void* operator new(size_t size);
+        static void operator delete(void* memory);
+    };
+
+    /* a time-ordered collection of EnqueuedMessages. messages due at the same
+    time are ordered by their sequence number, so they pop in FIFO order. */
+    class TimerQueue {
+        public:
+            enum class Type: int {
+                List, Heap
+            };
+
+            static TimerQueue* Create(Type type);
+
+            static inline bool Earlier(EnqueuedMessage* a, EnqueuedMessage* b) {
+                if (a->time != b->time) {
+                    return a->time < b->time;
+                }
+                return a->sequence < b->sequence;
+            }
+
+            virtual ~TimerQueue() { }
+            virtual void Push(EnqueuedMessage* message) = 0;
+            virtual EnqueuedMessage* Top() = 0;
+            virtual EnqueuedMessage* Pop() = 0;
+            virtual void Erase(EnqueuedMessage* message) = 0;
+            virtual void ForEach(std::function<void(EnqueuedMessage*)> callback) = 0;
+            virtual size_t Size() = 0;
+    };
+
+    /* the original implementation: a sorted linked list. O(n) inserts. */
+    class ListTimerQueue : public TimerQueue {
+        public:
+            virtual void Push(EnqueuedMessage* message) override;
+            virtual EnqueuedMessage* Top() override;
+            virtual EnqueuedMessage* Pop() override;
+            virtual void Erase(EnqueuedMessage* message) override;
+            virtual void ForEach(std::function<void(EnqueuedMessage*)> callback) override;
+            virtual size_t Size() override;
+
+        private:
+            std::list<EnqueuedMessage*> queue;
+    };
+
+    /* a binary min-heap. O(log n) inserts and removals. each message tracks
+    its own index in the heap so it can be erased without a search. */
+    class HeapTimerQueue : public TimerQueue {
+        public:
+            virtual void Push(EnqueuedMessage* message) override;
+            virtual EnqueuedMessage* Top() override;
+            virtual EnqueuedMessage* Pop() override;
+            virtual void Erase(EnqueuedMessage* message) override;
+            virtual void ForEach(std::function<void(EnqueuedMessage*)> callback) override;
+            virtual size_t Size() override;
+
+        private:
+            void SiftUp(size_t index);
+            void SiftDown(size_t index);
+            void Place(size_t index, EnqueuedMessage* message);
+
+            std::vector<EnqueuedMessage*> heap;
+    };
+
+} }
@@ -0,0 +1,167 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/Message.h>
+#include <f8n/runtime/Pool.h>
+
+#include <cassert>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace f8n { namespace runtime {
+
+    /* a Message that carries a payload of type T. small payloads live
+    inline, in the same pooled block as the message and its control block;
+    larger ones (or ones that may throw when moved) are moved into a
+    separately allocated box. receivers read the payload via
+    TypedMessage<T>::Payload(message), which is a static_cast -- the message
+    type is what identifies the payload, just like UserData1/2. debug builds
+    verify the cast. works with Post, Debounce, and Broadcast like any
+    other message. */
+    template <typename T>
+    class TypedMessage : public Message {
+        public:
+            static const size_t InlineCapacity = 64;
+
+            static const bool IsInline =
+                sizeof(T) <= InlineCapacity &&
+                std::is_nothrow_move_constructible<T>::value;
+
+            template <typename... Args>
+            static IMessagePtr Create(
+                IMessageTarget* target,
+                int messageType,
+                Args&&... args)
+            {
+                return Create(
+                    target,
+                    messageType,
+                    MessagePriority::Normal,
+                    std::forward<Args>(args)...);
+            }
+
+            template <typename... Args>
+            static IMessagePtr Create(
+                IMessageTarget* target,
+                int messageType,
+                MessagePriority priority,
+                Args&&... args)
+            {
+                return std::allocate_shared<Pooled>(
+                    PoolAllocator<Pooled>(),
+                    target,
+                    messageType,
+                    priority,
+                    std::forward<Args>(args)...);
+            }
+
+            static T& Payload(IMessage& message) {
+                assert(dynamic_cast<TypedMessage<T>*>(&message) != nullptr);
+                return static_cast<TypedMessage<T>&>(message).Get();
+            }
+
+            T& Get() {
+                return this->storage.Get();
+            }
+
+        protected:
+            template <typename... Args>
+            TypedMessage(
+                IMessageTarget* target,
+                int messageType,
+                MessagePriority priority,
+                Args&&... args)
+            : Message(target, messageType, 0LL, 0LL, priority)
+            , storage(std::forward<Args>(args)...) {
+            }
+
+        private:
+            template <typename U, bool Inline>
+            struct Storage;
+
+            template <typename U>
+            struct Storage<U, true> {
+                template <typename... Args>
+                Storage(Args&&... args)
+                : value(std::forward<Args>(args)...) {
+                }
+
+                U& Get() {
+                    return this->value;
+                }
+
+                U value;
+            };
+
+            template <typename U>
+            struct Storage<U, false> {
+                template <typename... Args>
+                Storage(Args&&... args)
+                : value(new U(std::forward<Args>(args)...)) {
+                }
+
+                U& Get() {
+                    return *this->value;
+                }
+
+                std::unique_ptr<U> value;
+            };
+
+            /* the constructor is protected; this gives allocate_shared
+            something it can construct. */
+            struct Pooled;
+
+            Storage<T, IsInline> storage;
+    };
+
+    template <typename T>
+    struct TypedMessage<T>::Pooled : public TypedMessage<T> {
+        template <typename... Args>
+        Pooled(
+            IMessageTarget* target,
+            int messageType,
+            MessagePriority priority,
+            Args&&... args)
+        : TypedMessage<T>(
+            target,
+            messageType,
+            priority,
+            std::forward<Args>(args)...) {
+        }
+    };
+
+} }
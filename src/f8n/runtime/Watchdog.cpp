@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <f8n/runtime/Watchdog.h>
+#include <f8n/debug/debug.h>
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std::chrono;
+using namespace f8n::runtime;
+
+using LockT = std::unique_lock<std::mutex>;
+
+static std::string describe(const MessageQueue::HandlerState& state) {
+    char buffer[128];
+    snprintf(
+        buffer,
+        sizeof(buffer),
+        "target=%p type=%d elapsed=%lldms",
+        (void*) state.target,
+        state.type,
+        (long long) duration_cast<milliseconds>(state.elapsed).count());
+    return buffer;
+}
+
+Watchdog::Watchdog(MessageQueue& queue, milliseconds threshold, const std::string& tag)
+: queue(queue)
+, threshold(std::max(milliseconds(1), threshold))
+, tag(tag)
+, stopping(false)
+, stalls(0)
+, stalledGeneration(0) {
+    this->queue.EnableMonitoring(true);
+    this->thread = std::thread(&Watchdog::ThreadProc, this);
+}
+
+Watchdog::~Watchdog() {
+    {
+        LockT lock(this->mutex);
+        this->stopping = true;
+    }
+    this->stopped.notify_all();
+    this->thread.join();
+    this->queue.EnableMonitoring(false);
+}
+
+void Watchdog::ThreadProc() {
+    /* polling at a fraction of the threshold bounds how late we notice */
+    const milliseconds interval = std::max(milliseconds(1), this->threshold / 4);
+
+    LockT lock(this->mutex);
+
+    while (!this->stopped.wait_for(lock, interval, [this] { return this->stopping; })) {
+        MessageQueue::HandlerState state = this->queue.GetHandlerState();
+
+        if (this->stalledGeneration &&
+            (!state.busy || state.generation != this->stalledGeneration))
+        {
+            f8n::debug::warning(this->tag, "handler returned: " + describe(this->stalledState));
+            this->stalledGeneration = 0;
+        }
+
+        if (state.busy) {
+            if (state.generation == this->stalledGeneration) {
+                this->stalledState = state;
+            }
+            else if (state.elapsed >= this->threshold) {
+                ++this->stalls;
+                this->stalledGeneration = state.generation;
+                this->stalledState = state;
+                f8n::debug::error(this->tag, "handler stalled: " + describe(state));
+            }
+        }
+    }
+}
+
+nlohmann::json Watchdog::Stats() {
+    nlohmann::json result;
+    {
+        LockT lock(this->mutex);
+        result["thresholdMs"] = this->threshold.count();
+        result["stalls"] = this->stalls;
+        result["stalled"] = this->stalledGeneration != 0;
+        if (this->stalledGeneration) {
+            result["current"] = describe(this->stalledState);
+        }
+    }
+    result["lagNs"] = this->queue.GetLoopLag().ToJson();
+    return result;
+}
+
+void Watchdog::Dump() {
+    f8n::debug::info(this->tag, this->Stats().dump());
+}
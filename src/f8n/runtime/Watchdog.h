@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2004-2020 musikcube team
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//      this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in the
+//      documentation and/or other materials provided with the distribution.
+//
+//    * Neither the name of the author nor the names of other contributors may
+//      be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <f8n/runtime/MessageQueue.h>
+
+#include <json.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace f8n { namespace runtime {
+
+    /* watches a MessageQueue from a background thread and logs (through
+    f8n::debug) whenever a single handler has been running for longer than
+    `threshold`, and again once it finally returns. enables monitoring on
+    the queue, which also collects a loop lag histogram; see Stats(). */
+    class Watchdog {
+        public:
+            Watchdog(
+                MessageQueue& queue,
+                std::chrono::milliseconds threshold,
+                const std::string& tag = "Watchdog");
+
+            ~Watchdog();
+
+            Watchdog(const Watchdog&) = delete;
+            Watchdog& operator=(const Watchdog&) = delete;
+
+            /* stall count, the current handler (if stalled), and the loop
+            lag histogram in nanoseconds */
+            nlohmann::json Stats();
+            void Dump();
+
+        private:
+            void ThreadProc();
+
+            MessageQueue& queue;
+            std::chrono::milliseconds threshold;
+            std::string tag;
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable stopped;
+            bool stopping;
+            uint64_t stalls;
+            uint64_t stalledGeneration; /* 0 if nothing is stalled */
+            MessageQueue::HandlerState stalledState;
+    };
+
+} }